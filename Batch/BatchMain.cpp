@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+
+    BatchMain.cpp
+    Created: 11 Apr 2022 9:01:40am
+    Author:  Bennett
+
+    Headless entry point for enhancing directories of recordings. Needs no
+    audio device or display.
+
+  ==============================================================================
+*/
+
+#include "BatchProcessor.h"
+#include <iostream>
+
+
+static void printUsage()
+{
+    std::cout << "Usage: SpectralSubtractionBatch --input <dir> --output <dir> [options]\n"
+                 "\n"
+                 "  --order <8-15>          FFT order, the window is 2^order samples (default 10)\n"
+                 "  --size <samples>        Window size, overrides --order. Rounded up to an even\n"
+                 "                          size whose half has no prime factor above 5, e.g. 960\n"
+                 "  --overlap <0-0.9>       Window overlap (default 0.5)\n"
+                 "  --window <name>         rectangular, triangular, hann, hamming, blackman,\n"
+                 "                          blackmanHarris, flatTop or kaiser (default hann)\n"
+                 "  --alpha <value>         Over-subtraction factor (default 4)\n"
+                 "  --floor <value>         Spectral floor (default 0.03)\n"
+                 "  --domain <name>         magnitude or power (default magnitude)\n"
+                 "  --bands <1-8>           Number of frequency bands (default 1)\n"
+                 "  --perceptual <1-40>     Compute the gains on this many ERB spaced bands (default off)\n"
+                 "  --noise-frames <n>      Frames in the noise estimate (default 10)\n"
+                 "  --adaptive              Track the noise with the adaptive estimate\n"
+                 "  --estimator <name>      smoothed or minimum, how the adaptive estimate follows the\n"
+                 "                          noise. minimum keeps tracking it through speech (default smoothed)\n"
+                 "  --rate <hz>             Process the band below this rate's Nyquist frequency at a\n"
+                 "                          whole fraction of the file's rate, e.g. 16000 (default off)\n"
+                 "  --upper-gain <dB>       Gain of the band above the processing rate, -100 or below\n"
+                 "                          removes it (default 0, passed through)\n"
+                 "  --threads <n>           Worker threads (default: one per core)\n"
+              << std::endl;
+}
+
+static Window::WindowingMethod parseWindow(const juce::String& name, bool& valid)
+{
+    const char* names[] = { "rectangular", "triangular", "hann", "hamming", "blackman", "blackmanHarris", "flatTop", "kaiser" };
+    for (int i = 0; i < Window::numWindowingMethods; ++i)
+    {
+        if (name.equalsIgnoreCase(names[i]))
+            return (Window::WindowingMethod)i;
+    }
+    valid = false;
+    return Window::hann;
+}
+
+
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+
+    if (args.containsOption("--help|-h") || !args.containsOption("--input") || !args.containsOption("--output"))
+    {
+        printUsage();
+        return args.containsOption("--help|-h") ? 0 : 1;
+    }
+
+    juce::File workingDirectory = juce::File::getCurrentWorkingDirectory();
+    juce::File inputDirectory = workingDirectory.getChildFile(args.getValueForOption("--input"));
+    juce::File outputDirectory = workingDirectory.getChildFile(args.getValueForOption("--output"));
+
+    if (!inputDirectory.isDirectory())
+    {
+        std::cout << inputDirectory.getFullPathName() << " is not a directory" << std::endl;
+        return 1;
+    }
+
+    BatchSettings settings;
+    bool valid = true;
+
+    if (args.containsOption("--order"))
+        settings.fftOrder = juce::jlimit(8, 15, args.getValueForOption("--order").getIntValue());
+    if (args.containsOption("--size"))
+        settings.fftSize = juce::jlimit(64, 32768, args.getValueForOption("--size").getIntValue());
+    if (args.containsOption("--overlap"))
+        settings.windowOverlap = juce::jlimit(0.f, 0.9f, args.getValueForOption("--overlap").getFloatValue());
+    if (args.containsOption("--window"))
+        settings.windowType = parseWindow(args.getValueForOption("--window"), valid);
+    if (args.containsOption("--alpha"))
+        settings.subtractionAlpha = args.getValueForOption("--alpha").getDoubleValue();
+    if (args.containsOption("--floor"))
+        settings.subtractionFloor = args.getValueForOption("--floor").getDoubleValue();
+    if (args.containsOption("--domain"))
+    {
+        juce::String domain = args.getValueForOption("--domain");
+        if (domain.equalsIgnoreCase("magnitude"))
+            settings.subtractionDomain = 1;
+        else if (domain.equalsIgnoreCase("power"))
+            settings.subtractionDomain = 2;
+        else
+            valid = false;
+    }
+    if (args.containsOption("--bands"))
+        settings.numFrequencyBands = juce::jlimit(1, 8, args.getValueForOption("--bands").getIntValue());
+    if (args.containsOption("--perceptual"))
+        settings.numPerceptualBands = juce::jlimit(1, PerceptualBands::maxBands, args.getValueForOption("--perceptual").getIntValue());
+    if (args.containsOption("--noise-frames"))
+        settings.noiseProfileFrames = juce::jmax(1, args.getValueForOption("--noise-frames").getIntValue());
+    settings.adaptiveEstimation = args.containsOption("--adaptive");
+    if (args.containsOption("--estimator"))
+    {
+        juce::String estimator = args.getValueForOption("--estimator");
+        if (estimator.equalsIgnoreCase("smoothed"))
+            settings.noiseEstimator = SpectralSubtraction::smoothedEstimator;
+        else if (estimator.equalsIgnoreCase("minimum"))
+            settings.noiseEstimator = SpectralSubtraction::minimumTracking;
+        else
+            valid = false;
+    }
+    if (args.containsOption("--rate"))
+        settings.processingRate = juce::jmax(0.f, args.getValueForOption("--rate").getFloatValue());
+    if (args.containsOption("--upper-gain"))
+        settings.upperBandGain = juce::Decibels::decibelsToGain(args.getValueForOption("--upper-gain").getFloatValue());
+
+    int numThreads = juce::SystemStats::getNumCpus();
+    if (args.containsOption("--threads"))
+        numThreads = juce::jmax(1, args.getValueForOption("--threads").getIntValue());
+
+    if (!valid)
+    {
+        printUsage();
+        return 1;
+    }
+
+    BatchProcessor processor(settings, numThreads);
+    return processor.run(inputDirectory, outputDirectory) ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/*
+  ==============================================================================
+
+    BatchProcessor.cpp
+    Created: 11 Apr 2022 9:02:15am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "BatchProcessor.h"
+#include <iostream>
+
+
+// Configure an engine for a batch. The noise profile is taken from the start of each file
+void BatchSettings::applyTo(SpectralSubtraction& engine) const
+{
+    // Whole files are rendered, so no block size is needed
+    if (fftSize > 0)
+        engine.prepareFFTSize(0, fftSize);
+    engine.setWindowOverlap(windowOverlap);
+    engine.setWindowType(windowType);
+    engine.setSubtractionConstant(subtractionAlpha);
+    engine.setSubtractionFloor(subtractionFloor);
+    engine.setSubtractionDomain(subtractionDomain);
+    engine.setNumFrequencyBands(numFrequencyBands);
+    engine.setPerceptualBandsEnabled(numPerceptualBands > 0);
+    if (numPerceptualBands > 0)
+        engine.setNumPerceptualBands(numPerceptualBands);
+    engine.setNoiseProfileFrames(noiseProfileFrames);
+    engine.setNoiseEstimationEnabled(true);
+    engine.setAdaptiveEstimationEnabled(adaptiveEstimation);
+    engine.setNoiseEstimator(noiseEstimator);
+    engine.setProcessingRate(processingRate);
+    engine.setUpperBandGain(upperBandGain);
+    engine.setSubtractionEnabled(true);
+}
+
+
+BatchProcessor::BatchProcessor(const BatchSettings& batchSettings, int numThreads)
+    : settings(batchSettings), numWorkers(juce::jmax(1, numThreads))
+{
+    formatManager.registerBasicFormats();
+}
+
+// Process every readable audio file in inputDirectory into a wav of the same name in outputDirectory
+bool BatchProcessor::run(const juce::File& inputDirectory, const juce::File& outputDirectory)
+{
+    files = inputDirectory.findChildFiles(juce::File::findFiles, false, formatManager.getWildcardForAllFormats());
+    files.sort();
+    if (files.isEmpty())
+    {
+        std::cout << "No audio files found in " << inputDirectory.getFullPathName() << std::endl;
+        return true;
+    }
+
+    outputFolder = outputDirectory;
+    if (!outputFolder.createDirectory())
+    {
+        std::cout << "Could not create " << outputFolder.getFullPathName() << std::endl;
+        return false;
+    }
+
+    results.assign(files.size(), BatchResult());
+    nextFile = 0;
+
+    // Time the fft engines up front for the window and the smaller power of two sizes a reduced processing rate may use
+    const int maxOrder = settings.fftSize > 0 ? juce::findHighestSetBit((juce::uint32)settings.fftSize) + 1 : settings.fftOrder;
+    FFTBackend::selectFastestTypes(1, juce::jmin(15, maxOrder));
+
+    int numJobs = juce::jmin(numWorkers, files.size());
+    std::cout << "Processing " << files.size() << " files on " << numJobs << " threads" << std::endl;
+
+    double startTime = juce::Time::getMillisecondCounterHiRes();
+    {
+        juce::ThreadPool pool(numJobs);
+        std::atomic<int> jobsRemaining { numJobs };
+        juce::WaitableEvent finished;
+
+        // One engine per worker, reused for every file the worker claims
+        for (int j = 0; j < numJobs; ++j)
+        {
+            pool.addJob([this, &jobsRemaining, &finished]
+            {
+                SpectralSubtraction engine(settings.fftOrder);
+                settings.applyTo(engine);
+                processFiles(engine);
+
+                if (--jobsRemaining == 0)
+                    finished.signal();
+                return juce::ThreadPoolJob::jobHasFinished;
+            });
+        }
+        finished.wait();
+    }
+    double elapsedSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+    // Aggregate throughput is measured against wall time, so it includes reading and writing
+    double audioSeconds = 0;
+    double processSeconds = 0;
+    int numFailed = 0;
+    for (const BatchResult& result : results)
+    {
+        audioSeconds += result.audioSeconds;
+        processSeconds += result.processSeconds;
+        if (!result.succeeded)
+            ++numFailed;
+    }
+
+    std::cout << juce::String(files.size() - numFailed) << " of " << files.size() << " files processed, "
+              << juce::String(audioSeconds, 1) << " s of audio in " << juce::String(elapsedSeconds, 2) << " s ("
+              << juce::String(audioSeconds / juce::jmax(elapsedSeconds, 1e-9), 1) << "x realtime overall, "
+              << juce::String(audioSeconds / juce::jmax(processSeconds, 1e-9), 1) << "x realtime per thread)" << std::endl;
+
+    return numFailed == 0;
+}
+
+// Claim and process files until every file has been taken
+void BatchProcessor::processFiles(SpectralSubtraction& engine)
+{
+    for (int i = nextFile++; i < files.size(); i = nextFile++)
+    {
+        results[i] = processFile(files[i], engine);
+        logResult(results[i]);
+    }
+}
+
+// Read, enhance and write a single file. Only the enhancement is timed
+BatchResult BatchProcessor::processFile(const juce::File& file, SpectralSubtraction& engine)
+{
+    BatchResult result;
+    result.name = file.getFileName();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
+    if (reader == nullptr)
+    {
+        result.error = "could not be read";
+        return result;
+    }
+
+    int numChannels = (int)reader->numChannels;
+    int numSamples = (int)reader->lengthInSamples;
+    double sampleRate = reader->sampleRate;
+    int bitDepth = reader->bitsPerSample >= 24 ? 24 : 16;
+
+    juce::AudioSampleBuffer input(numChannels, numSamples);
+    juce::AudioSampleBuffer output(numChannels, numSamples);
+    reader->read(&input, 0, numSamples, 0, true, true);
+    reader.reset();
+
+    double startTime = juce::Time::getMillisecondCounterHiRes();
+
+    // The first channel's opening frames are taken as the noise profile for every channel
+    engine.setSampleRate((float)sampleRate);
+    engine.setSignal(&input);
+    engine.computeFileNoiseProfile();
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        engine.resetEstimation();
+        engine.renderBuffer(input.getReadPointer(channel), output.getWritePointer(channel), numSamples);
+    }
+    engine.setSignal(nullptr);
+
+    result.processSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+    result.audioSeconds = numSamples / sampleRate;
+
+    juce::File outputFile = outputFolder.getChildFile(file.getFileNameWithoutExtension() + ".wav");
+    outputFile.deleteFile();
+
+    std::unique_ptr<juce::FileOutputStream> stream(outputFile.createOutputStream());
+    if (stream == nullptr)
+    {
+        result.error = "could not open " + outputFile.getFullPathName();
+        return result;
+    }
+
+    juce::WavAudioFormat format;
+    std::unique_ptr<juce::AudioFormatWriter> writer(format.createWriterFor(stream.get(), sampleRate, (unsigned int)numChannels, bitDepth, {}, 0));
+    if (writer == nullptr)
+    {
+        result.error = "could not be written";
+        return result;
+    }
+
+    // The writer owns the stream from here
+    stream.release();
+    result.succeeded = writer->writeFromAudioSampleBuffer(output, 0, numSamples);
+    if (!result.succeeded)
+        result.error = "write failed";
+
+    return result;
+}
+
+void BatchProcessor::logResult(const BatchResult& result)
+{
+    const juce::ScopedLock lock(logLock);
+
+    if (result.succeeded)
+    {
+        std::cout << "  " << result.name << ": " << juce::String(result.audioSeconds, 2) << " s in "
+                  << juce::String(result.processSeconds * 1000.0, 1) << " ms ("
+                  << juce::String(result.audioSeconds / juce::jmax(result.processSeconds, 1e-9), 1) << "x realtime)" << std::endl;
+    }
+    else
+    {
+        std::cout << "  " << result.name << " " << result.error << std::endl;
+    }
+}
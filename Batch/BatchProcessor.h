@@ -0,0 +1,72 @@
+/*
+  ==============================================================================
+
+    BatchProcessor.h
+    Created: 11 Apr 2022 9:02:15am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_audio_formats/juce_audio_formats.h>
+#include "SpectralSubtraction.h"
+
+
+// Subtraction settings applied to every file in a batch
+struct BatchSettings
+{
+    void applyTo(SpectralSubtraction& engine) const;
+
+    int fftOrder = 10;
+    int fftSize = 0; // In samples, overrides fftOrder when set
+    float windowOverlap = 0.5f;
+    Window::WindowingMethod windowType = Window::hann;
+    double subtractionAlpha = 4;
+    double subtractionFloor = 0.03;
+    int subtractionDomain = 1;
+    int numFrequencyBands = 1;
+    int numPerceptualBands = 0; // 0 uses the frequency bands
+    int noiseProfileFrames = 10;
+    bool adaptiveEstimation = false;
+    SpectralSubtraction::NoiseEstimator noiseEstimator = SpectralSubtraction::smoothedEstimator;
+    float processingRate = 0; // 0 processes at each file's own rate
+    float upperBandGain = 1;
+};
+
+// Timing for one processed file
+struct BatchResult
+{
+    juce::String name;
+    double audioSeconds = 0;
+    double processSeconds = 0;
+    bool succeeded = false;
+    juce::String error;
+};
+
+
+// Processes every audio file in a directory without an audio device. Worker threads each own an engine
+// and claim the next unprocessed file until none are left
+class BatchProcessor
+{
+    public:
+        BatchProcessor(const BatchSettings& batchSettings, int numThreads);
+
+        // Returns false if any file failed
+        bool run(const juce::File& inputDirectory, const juce::File& outputDirectory);
+
+    private:
+        BatchSettings settings;
+        int numWorkers;
+
+        juce::AudioFormatManager formatManager;
+        juce::Array<juce::File> files;
+        std::vector<BatchResult> results;
+        std::atomic<int> nextFile { 0 };
+        juce::File outputFolder;
+        juce::CriticalSection logLock;
+
+        void processFiles(SpectralSubtraction& engine);
+        BatchResult processFile(const juce::File& file, SpectralSubtraction& engine);
+        void logResult(const BatchResult& result);
+};
@@ -0,0 +1,175 @@
+/*
+  ==============================================================================
+
+    SpectrumLayoutBenchmark.cpp
+    Created: 4 Apr 2022 3:40:18pm
+    Author:  Bennett
+
+    Times one frame of analysis, magnitude subtraction and resynthesis with the
+    old array-of-structs double spectrum against the in-place float kernels.
+    Built by the SpectrumLayoutBenchmark target in CMakeLists.txt
+
+  ==============================================================================
+*/
+
+#include <juce_dsp/juce_dsp.h>
+#include "../Source/SpectralKernels.h"
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+
+namespace
+{
+
+// The previous spectrum layout, kept here only as the reference path
+struct LegacyComplex
+{
+    double real = 0;
+    double imag = 0;
+};
+
+struct FrameData
+{
+    FrameData(int order) : fft(order), size(1 << order), numBins((size / 2) + 1),
+        input(size), window(size), noise(numBins, 0.01f),
+        legacyInput(size), legacyWindow(size), legacyNoise(numBins, 0.01), legacyFFT(2 * size),
+        legacySpectrum(numBins), legacyClean(numBins), legacyMagnitudes(numBins), legacyOutput(size),
+        spectrum(2 * size + SpectralKernels::alignment), magnitudes(numBins), gains(numBins), subtracted(numBins), output(size)
+    {
+        std::mt19937 rng(1);
+        std::normal_distribution<float> dist(0, 0.1f);
+        for (int i = 0; i < size; ++i)
+            legacyInput[i] = input[i] = dist(rng);
+
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(&window[0], size, juce::dsp::WindowingFunction<float>::hann, true, 0.0);
+        std::copy(window.begin(), window.end(), legacyWindow.begin());
+        bins = juce::snapPointerToAlignment(&spectrum[0], SpectralKernels::alignment);
+    }
+
+    juce::dsp::FFT fft;
+    int size;
+    int numBins;
+
+    std::vector<float> input;
+    std::vector<float> window;
+    std::vector<float> noise;
+
+    std::vector<double> legacyInput;
+    std::vector<double> legacyWindow;
+    std::vector<double> legacyNoise;
+    std::vector<float> legacyFFT;
+    std::vector<LegacyComplex> legacySpectrum;
+    std::vector<LegacyComplex> legacyClean;
+    std::vector<double> legacyMagnitudes;
+    std::vector<double> legacyOutput;
+
+    std::vector<float> spectrum;
+    float* bins = nullptr;
+    std::vector<float> magnitudes;
+    std::vector<float> gains;
+    std::vector<float> subtracted;
+    std::vector<float> output;
+};
+
+// Window, transform into structs, per bin magnitudes and gains, convert back and inverse transform
+float processLegacy(FrameData& d)
+{
+    for (int j = 0; j < d.size; ++j)
+        d.legacyFFT[j] = (float)(d.legacyWindow[j] * d.legacyInput[j]);
+    d.fft.performRealOnlyForwardTransform(&d.legacyFFT[0], true);
+    for (int k = 0; k < d.numBins; ++k)
+        d.legacySpectrum[k] = { d.legacyFFT[2 * k], d.legacyFFT[(2 * k) + 1] };
+
+    double sum = 0;
+    for (int k = 0; k < d.numBins; ++k)
+    {
+        const LegacyComplex& bin = d.legacySpectrum[k];
+        d.legacyMagnitudes[k] = std::sqrt((bin.real * bin.real) + (bin.imag * bin.imag));
+        sum += d.legacyMagnitudes[k];
+    }
+
+    for (int k = 0; k < d.numBins; ++k)
+    {
+        double Y = d.legacyMagnitudes[k];
+        double S = std::max(Y - 2.0 * d.legacyNoise[k], 0.03 * d.legacyNoise[k]);
+        double gain = Y > 0 ? S / Y : 0;
+        d.legacyClean[k] = { d.legacySpectrum[k].real * gain, d.legacySpectrum[k].imag * gain };
+    }
+
+    for (int k = 0; k < d.numBins; ++k)
+    {
+        d.legacyFFT[2 * k] = (float)d.legacyClean[k].real;
+        d.legacyFFT[(2 * k) + 1] = (float)d.legacyClean[k].imag;
+    }
+    d.fft.performRealOnlyInverseTransform(&d.legacyFFT[0]);
+    for (int j = 0; j < d.size; ++j)
+        d.legacyOutput[j] = d.legacyFFT[j];
+
+    return (float)(d.legacyOutput[d.size / 2] + sum);
+}
+
+// The same frame with the spectrum left in the transform buffer
+float processKernels(FrameData& d)
+{
+    SpectralKernels::applyWindow(d.bins, &d.input[0], &d.window[0], d.size);
+    d.fft.performRealOnlyForwardTransform(d.bins, true);
+
+    SpectralKernels::magnitude(&d.magnitudes[0], d.bins, d.numBins);
+    float sum = SpectralKernels::sum(&d.magnitudes[0], 0, d.numBins);
+
+    SpectralKernels::subtractionGains<false>(&d.gains[0], &d.subtracted[0], &d.magnitudes[0], &d.noise[0],
+                                             2.f, 0.03f, 0, d.numBins);
+    SpectralKernels::applyGains(d.bins, &d.gains[0], d.numBins);
+
+    d.fft.performRealOnlyInverseTransform(d.bins);
+    juce::FloatVectorOperations::copy(&d.output[0], d.bins, d.size);
+
+    return d.output[d.size / 2] + sum;
+}
+
+// Best of several runs, in nanoseconds per frame
+template <typename Function>
+double timeFrames(FrameData& d, Function process, int iterations, float& sink)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto start = juce::Time::getHighResolutionTicks();
+        for (int i = 0; i < iterations; ++i)
+            sink += process(d);
+        auto end = juce::Time::getHighResolutionTicks();
+
+        double seconds = juce::Time::highResolutionTicksToSeconds(end - start);
+        best = std::min(best, (seconds * 1e9) / iterations);
+    }
+    return best;
+}
+
+}
+
+
+int main()
+{
+    float sink = 0;
+    std::printf("%6s %14s %14s %9s %12s\n", "order", "legacy ns", "kernels ns", "speedup", "max diff");
+
+    for (int order = 8; order <= 13; ++order)
+    {
+        FrameData data(order);
+        int iterations = std::max(1, (1 << 22) >> order);
+
+        double legacy = timeFrames(data, processLegacy, iterations, sink);
+        double kernels = timeFrames(data, processKernels, iterations, sink);
+
+        // Both paths should resynthesise the same frame
+        float maxDiff = 0;
+        for (int j = 0; j < data.size; ++j)
+            maxDiff = std::max(maxDiff, (float)std::abs(data.legacyOutput[j] - data.output[j]));
+
+        std::printf("%6d %14.1f %14.1f %8.2fx %12.3g\n", order, legacy, kernels, legacy / kernels, maxDiff);
+    }
+
+    // Keeps the optimiser from discarding either path
+    return sink == 12345.f ? 1 : 0;
+}
@@ -0,0 +1,415 @@
+/*
+  ==============================================================================
+
+    StageBenchmark.cpp
+    Created: 18 Apr 2022 10:15:32am
+    Author:  Bennett
+
+    Times each processing stage of SpectralSubtraction for every fft order, band
+    count and subtraction domain, optionally on perceptual bands, and reports ns/frame, frames/s and the realtime
+    factor at 48 kHz. Results can be written as JSON and compared against an
+    earlier run. Built by the SpectralSubtractionBenchmark target in CMakeLists.txt
+
+  ==============================================================================
+*/
+
+#include <juce_dsp/juce_dsp.h>
+#include "SpectralSubtraction.h"
+#include <cstdio>
+#include <map>
+#include <random>
+
+
+namespace
+{
+
+const double benchmarkSampleRate = 48000;
+
+// Every stage runs over a block of this many frames, so per frame numbers include no per call setup
+const int framesPerBlock = 32;
+
+// Timing of one stage for one configuration
+struct StageResult
+{
+    juce::String stage;
+    int order = 0;
+    int bands = 0;
+    int perceptualBands = 0;
+    juce::String domain;
+    double nsPerFrame = 0;
+    double framesPerSecond = 0;
+    double realtimeFactor = 0;
+
+    juce::String getKey() const
+    {
+        juce::String key = stage + "/" + juce::String(order) + "/" + juce::String(bands) + "/" + domain;
+        return perceptualBands > 0 ? key + "/erb" + juce::String(perceptualBands) : key;
+    }
+};
+
+const char* domainName(int domain)
+{
+    return domain == 2 ? "power" : "magnitude";
+}
+
+}
+
+
+// Runs the private stages of one engine configuration on a block of noisy frames
+class StageBenchmark
+{
+    public:
+        StageBenchmark(int fftOrder, int numBands, int domain, int numPerceptualBands, double minSeconds);
+
+        void run(std::vector<StageResult>& results);
+
+    private:
+        SpectralSubtraction engine;
+        int order;
+        int bands;
+        int subtractionDomain;
+        int perceptualBands;
+        double minTime;
+
+        const SpectralSubtraction::Config* config = nullptr;
+        int numSamples;
+        std::vector<float> input;
+        std::vector<float> work;
+        SpectrumMatrix windowed;
+        SpectrumMatrix spectra;
+        Matrix magnitudes;
+
+        // Best time of a process call over at least minTime of runs. Setup runs before each call untimed
+        template <typename Setup, typename Process>
+        StageResult measure(const char* stage, Setup setup, Process process);
+};
+
+
+StageBenchmark::StageBenchmark(int fftOrder, int numBands, int domain, int numPerceptualBands, double minSeconds)
+    : engine(fftOrder), order(fftOrder), bands(numBands), subtractionDomain(domain), perceptualBands(numPerceptualBands), minTime(minSeconds)
+{
+    int windowSize = 1 << fftOrder;
+    int hopSize = windowSize / 2;
+    numSamples = ((framesPerBlock - 1) * hopSize) + windowSize;
+
+    engine.prepare(numSamples, fftOrder);
+    engine.setSampleRate((float)benchmarkSampleRate);
+    engine.setWindowType(Window::hann);
+    engine.setSubtractionDomain(subtractionDomain);
+    engine.setNumFrequencyBands(bands);
+    engine.setPerceptualBandsEnabled(perceptualBands > 0);
+    if (perceptualBands > 0)
+        engine.setNumPerceptualBands(perceptualBands);
+    engine.setSubtractionEnabled(true);
+
+    // A tone in white noise, the noise profile is taken from noise alone
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0, 0.05f);
+    input.resize(numSamples);
+    for (int i = 0; i < numSamples; ++i)
+        input[i] = noise(rng) + 0.3f * std::sin(juce::MathConstants<float>::twoPi * 440.f * i / (float)benchmarkSampleRate);
+    work = input;
+
+    std::vector<float> noiseProfile(engine.getNoiseProfileSize());
+    for (float& sample : noiseProfile)
+        sample = noise(rng);
+    engine.setAverageNoise(engine.bufferToNoiseProfile(noiseProfile));
+
+    // Every setting is in place, so the stages can share one configuration
+    config = &engine.acquireConfig();
+    SpectralSubtraction::ProcessingState& state = *config->processing;
+
+    // Windowed frames, their spectra and the noisy spectrum in the subtraction domain, per band on perceptual bands
+    FrameView frames(input.data(), numSamples, windowSize, hopSize);
+    windowed.assign(framesPerBlock, Spectrum(windowSize));
+    spectra.assign(framesPerBlock, Spectrum(windowSize));
+    magnitudes.assign(framesPerBlock, Frame(config->numBins, 0));
+    for (int i = 0; i < framesPerBlock; ++i)
+    {
+        SpectralKernels::applyWindow(windowed[i].data(), frames.getFrame(i), config->getWindow().data(), windowSize);
+        engine.frequencySpectrum(*config, frames.getRegions(i), state.blockSpectra[i], state.workspace);
+        if (subtractionDomain == 1)
+            engine.complexToMagnitudeSpectrum(state.blockSpectra[i], magnitudes[i]);
+        else
+            engine.complexToPowerSpectrum(state.blockSpectra[i], magnitudes[i]);
+        if (config->perceptualBands != nullptr)
+        {
+            Frame bins = magnitudes[i];
+            config->perceptualBands->binsToBands(bins.data(), magnitudes[i].data());
+        }
+    }
+}
+
+void StageBenchmark::run(std::vector<StageResult>& results)
+{
+    SpectralSubtraction::ProcessingState& state = *config->processing;
+    FrameView frames(input.data(), numSamples, config->windowSize, config->hopSize);
+    FrameWorkspace& workspace = state.workspace;
+    auto noSetup = [] {};
+
+    // Framing and analysis of a whole block, including the adaptive estimate check
+    results.push_back(measure("createFrequencyData", noSetup, [&]
+    {
+        engine.createFrequencyData(*config, frames, state.blockSpectra);
+    }));
+
+    results.push_back(measure("frequencySpectrum", noSetup, [&]
+    {
+        for (int i = 0; i < framesPerBlock; ++i)
+            engine.frequencySpectrum(*config, frames.getRegions(i), state.blockSpectra[i], workspace);
+    }));
+
+    // The transforms work in place, so their inputs are restored before each run
+    results.push_back(measure("calculateFFT", [&] { spectra = windowed; }, [&]
+    {
+        for (int i = 0; i < framesPerBlock; ++i)
+            engine.calculateFFT(spectra[i], workspace);
+    }));
+
+    results.push_back(measure("calculateIFFT", [&] { spectra = state.blockSpectra; }, [&]
+    {
+        for (int i = 0; i < framesPerBlock; ++i)
+            engine.calculateIFFT(spectra[i], state.blockCleanFrames[i], workspace);
+    }));
+
+    results.push_back(measure("processSubtraction", noSetup, [&]
+    {
+        engine.subtractFrames(*config, state.blockSpectra, framesPerBlock, state.blockCleanFrames);
+    }));
+
+    // Fill the estimation ring first so every update runs the recursion
+    for (int i = 0; i < config->noiseProfileFrames; ++i)
+        engine.updateNoiseEstimation(*config, magnitudes[i % framesPerBlock]);
+
+    results.push_back(measure("updateNoiseEstimation", noSetup, [&]
+    {
+        for (int i = 0; i < framesPerBlock; ++i)
+            engine.updateNoiseEstimation(*config, magnitudes[i]);
+    }));
+    engine.clearEstimation(*config->estimation);
+
+    // Minimum tracking on the same frames, the first only fills its arrays
+    engine.trackNoiseMinimum(*config, magnitudes[0]);
+    results.push_back(measure("trackNoiseMinimum", noSetup, [&]
+    {
+        for (int i = 0; i < framesPerBlock; ++i)
+            engine.trackNoiseMinimum(*config, magnitudes[i]);
+    }));
+    engine.clearEstimation(*config->estimation);
+
+    results.push_back(measure("createSamplesFromFrames", noSetup, [&]
+    {
+        engine.createSamplesFromFrames(*config, state.blockCleanFrames, framesPerBlock, config->windowSize, config->hopSize, state.blockSamples);
+    }));
+
+    results.push_back(measure("processBuffer", [&] { std::copy(input.begin(), input.end(), work.begin()); }, [&]
+    {
+        engine.processBuffer(work.data(), numSamples);
+    }));
+}
+
+template <typename Setup, typename Process>
+StageResult StageBenchmark::measure(const char* stage, Setup setup, Process process)
+{
+    double best = 1e30;
+    double total = 0;
+    for (int run = 0; run < 3 || total < minTime; ++run)
+    {
+        setup();
+        auto start = juce::Time::getHighResolutionTicks();
+        process();
+        auto end = juce::Time::getHighResolutionTicks();
+
+        double seconds = juce::Time::highResolutionTicksToSeconds(end - start);
+        best = juce::jmin(best, seconds);
+        total += seconds;
+    }
+
+    // Each frame moves the signal on by one hop
+    StageResult result;
+    result.stage = stage;
+    result.order = order;
+    result.bands = bands;
+    result.perceptualBands = perceptualBands;
+    result.domain = domainName(subtractionDomain);
+    result.nsPerFrame = (best * 1e9) / framesPerBlock;
+    result.framesPerSecond = 1e9 / juce::jmax(result.nsPerFrame, 1e-3);
+    result.realtimeFactor = result.framesPerSecond * config->hopSize / benchmarkSampleRate;
+    return result;
+}
+
+
+namespace
+{
+
+void printUsage()
+{
+    std::printf("Usage: SpectralSubtractionBenchmark [options]\n"
+                "\n"
+                "  --orders <a-b>          FFT orders to time (default 8-15)\n"
+                "  --bands <a-b>           Band counts to time (default 1-8)\n"
+                "  --domain <name>         magnitude, power or both (default both)\n"
+                "  --perceptual <n>        Compute the gains on n ERB spaced bands (default off)\n"
+                "  --min-time <ms>         Minimum time spent on each measurement (default 20)\n"
+                "  --json <file>           Write the results as JSON\n"
+                "  --baseline <file>       Compare against the JSON of an earlier run\n");
+}
+
+// Parses "a-b" or a single value, limited to [low, high]
+bool parseRange(const juce::String& text, int low, int high, int& first, int& last)
+{
+    juce::String lower = text.upToFirstOccurrenceOf("-", false, false);
+    juce::String upper = text.contains("-") ? text.fromFirstOccurrenceOf("-", false, false) : lower;
+    first = lower.getIntValue();
+    last = upper.getIntValue();
+    if (lower.isEmpty() || upper.isEmpty() || first < low || last > high || first > last)
+        return false;
+    return true;
+}
+
+// ns/frame of each result in an earlier run's JSON, by stage and configuration
+std::map<juce::String, double> loadBaseline(const juce::File& file)
+{
+    std::map<juce::String, double> baseline;
+    juce::var parsed = juce::JSON::parse(file.loadFileAsString());
+    if (auto* entries = parsed["results"].getArray())
+    {
+        for (const juce::var& entry : *entries)
+        {
+            StageResult result;
+            result.stage = entry["stage"].toString();
+            result.order = entry["order"];
+            result.bands = entry["bands"];
+            result.domain = entry["domain"].toString();
+            result.perceptualBands = entry["perceptualBands"];
+            baseline[result.getKey()] = entry["nsPerFrame"];
+        }
+    }
+    return baseline;
+}
+
+juce::var resultsToJSON(const std::vector<StageResult>& results)
+{
+    juce::Array<juce::var> entries;
+    for (const StageResult& result : results)
+    {
+        juce::DynamicObject::Ptr entry = new juce::DynamicObject();
+        entry->setProperty("stage", result.stage);
+        entry->setProperty("order", result.order);
+        entry->setProperty("bands", result.bands);
+        entry->setProperty("domain", result.domain);
+        entry->setProperty("perceptualBands", result.perceptualBands);
+        entry->setProperty("nsPerFrame", result.nsPerFrame);
+        entry->setProperty("framesPerSecond", result.framesPerSecond);
+        entry->setProperty("realtimeFactor", result.realtimeFactor);
+        entries.add(juce::var(entry.get()));
+    }
+
+    juce::DynamicObject::Ptr root = new juce::DynamicObject();
+    root->setProperty("sampleRate", benchmarkSampleRate);
+    root->setProperty("framesPerBlock", framesPerBlock);
+    root->setProperty("results", entries);
+    return juce::var(root.get());
+}
+
+}
+
+
+int main(int argc, char* argv[])
+{
+    juce::ArgumentList args(argc, argv);
+    if (args.containsOption("--help|-h"))
+    {
+        printUsage();
+        return 0;
+    }
+
+    int firstOrder = 8, lastOrder = 15;
+    int firstBands = 1, lastBands = 8;
+    std::vector<int> domains { 1, 2 };
+    int perceptualBands = 0;
+    double minSeconds = 0.02;
+    bool valid = true;
+
+    if (args.containsOption("--orders"))
+        valid &= parseRange(args.getValueForOption("--orders"), 8, 15, firstOrder, lastOrder);
+    if (args.containsOption("--bands"))
+        valid &= parseRange(args.getValueForOption("--bands"), 1, 8, firstBands, lastBands);
+    if (args.containsOption("--domain"))
+    {
+        juce::String domain = args.getValueForOption("--domain");
+        if (domain.equalsIgnoreCase("magnitude"))
+            domains = { 1 };
+        else if (domain.equalsIgnoreCase("power"))
+            domains = { 2 };
+        else if (!domain.equalsIgnoreCase("both"))
+            valid = false;
+    }
+    if (args.containsOption("--perceptual"))
+        perceptualBands = juce::jlimit(0, PerceptualBands::maxBands, args.getValueForOption("--perceptual").getIntValue());
+    if (args.containsOption("--min-time"))
+        minSeconds = juce::jmax(0.0, args.getValueForOption("--min-time").getDoubleValue() / 1000.0);
+
+    if (!valid)
+    {
+        printUsage();
+        return 1;
+    }
+
+    juce::File workingDirectory = juce::File::getCurrentWorkingDirectory();
+    std::map<juce::String, double> baseline;
+    if (args.containsOption("--baseline"))
+    {
+        juce::File baselineFile = workingDirectory.getChildFile(args.getValueForOption("--baseline"));
+        baseline = loadBaseline(baselineFile);
+        if (baseline.empty())
+        {
+            std::printf("No results found in %s\n", baselineFile.getFullPathName().toRawUTF8());
+            return 1;
+        }
+    }
+
+    // Engines are built on the fastest fft type for each order, as the app picks them
+    FFTBackend::selectFastestTypes(firstOrder, lastOrder);
+
+    std::printf("%-24s %5s %5s %-9s %12s %12s %10s%s\n", "stage", "order", "bands", "domain",
+                "ns/frame", "frames/s", "realtime", baseline.empty() ? "" : "  vs baseline");
+
+    std::vector<StageResult> results;
+    for (int order = firstOrder; order <= lastOrder; ++order)
+    {
+        for (int bands = firstBands; bands <= lastBands; ++bands)
+        {
+            for (int domain : domains)
+            {
+                size_t first = results.size();
+                StageBenchmark(order, bands, domain, perceptualBands, minSeconds).run(results);
+
+                for (size_t i = first; i < results.size(); ++i)
+                {
+                    const StageResult& result = results[i];
+                    std::printf("%-24s %5d %5d %-9s %12.1f %12.0f %9.1fx", result.stage.toRawUTF8(), result.order, result.bands,
+                                result.domain.toRawUTF8(), result.nsPerFrame, result.framesPerSecond, result.realtimeFactor);
+
+                    // Speedup over the baseline, above 1 is faster
+                    auto previous = baseline.find(result.getKey());
+                    if (previous != baseline.end())
+                        std::printf("  %10.2fx", previous->second / result.nsPerFrame);
+                    std::printf("\n");
+                }
+            }
+        }
+    }
+
+    if (args.containsOption("--json"))
+    {
+        juce::File jsonFile = workingDirectory.getChildFile(args.getValueForOption("--json"));
+        if (!jsonFile.replaceWithText(juce::JSON::toString(resultsToJSON(results))))
+        {
+            std::printf("Could not write %s\n", jsonFile.getFullPathName().toRawUTF8());
+            return 1;
+        }
+    }
+
+    return 0;
+}
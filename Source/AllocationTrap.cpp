@@ -0,0 +1,68 @@
+/*
+  ==============================================================================
+
+    AllocationTrap.cpp
+    Created: 17 Oct 2026 10:12:41am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "AllocationTrap.h"
+#include <cstdlib>
+#include <new>
+
+#if JUCE_DEBUG
+
+// Depth of nested traps on this thread
+static thread_local int trapDepth = 0;
+
+ScopedAllocationTrap::ScopedAllocationTrap()  { ++trapDepth; }
+ScopedAllocationTrap::~ScopedAllocationTrap() { --trapDepth; }
+bool ScopedAllocationTrap::isActive() { return trapDepth > 0; }
+
+static void checkAllocation()
+{
+    if (trapDepth > 0)
+    {
+        // Disarm while asserting, the assertion handler may allocate itself
+        const int depth = trapDepth;
+        trapDepth = 0;
+        jassertfalse; // Allocator called on a thread that must not allocate
+        trapDepth = depth;
+    }
+}
+
+static void* trappedAllocate(std::size_t size)
+{
+    checkAllocation();
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+static void trappedFree(void* ptr) noexcept
+{
+    if (ptr != nullptr)
+        checkAllocation();
+    std::free(ptr);
+}
+
+void* operator new  (std::size_t size) { return trappedAllocate(size); }
+void* operator new[](std::size_t size) { return trappedAllocate(size); }
+void* operator new  (std::size_t size, const std::nothrow_t&) noexcept { checkAllocation(); return std::malloc(size == 0 ? 1 : size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { checkAllocation(); return std::malloc(size == 0 ? 1 : size); }
+void operator delete  (void* ptr) noexcept { trappedFree(ptr); }
+void operator delete[](void* ptr) noexcept { trappedFree(ptr); }
+void operator delete  (void* ptr, std::size_t) noexcept { trappedFree(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { trappedFree(ptr); }
+void operator delete  (void* ptr, const std::nothrow_t&) noexcept { trappedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { trappedFree(ptr); }
+
+#else
+
+ScopedAllocationTrap::ScopedAllocationTrap()  {}
+ScopedAllocationTrap::~ScopedAllocationTrap() {}
+bool ScopedAllocationTrap::isActive() { return false; }
+
+#endif
@@ -0,0 +1,26 @@
+/*
+  ==============================================================================
+
+    AllocationTrap.h
+    Created: 17 Oct 2026 10:12:41am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_core/juce_core.h>
+
+// While one of these is alive, any heap allocation or free on the current thread
+// hits an assertion in debug builds. Put one at the top of audio callbacks.
+class ScopedAllocationTrap
+{
+public:
+    ScopedAllocationTrap();
+    ~ScopedAllocationTrap();
+
+    static bool isActive();
+
+private:
+    JUCE_DECLARE_NON_COPYABLE(ScopedAllocationTrap)
+};
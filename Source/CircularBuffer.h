@@ -9,121 +9,147 @@
 */
 
 #pragma once
-#include <JuceHeader.h>
+#include <juce_core/juce_core.h>
+#include <atomic>
 
+// A single producer, single consumer ring. One thread writes and another reads at the same time without
+// locking or waiting, a full ring takes fewer items rather than blocking. The capacity is a power of two
+// so positions only ever count up and are masked into the storage
 template <class T>
 class CircularBuffer
 {
-public: 
-
-    CircularBuffer(int max_size) : buffer(std::make_unique<T[]>(max_size)), maxSize(max_size) {}
-
-    CircularBuffer(const CircularBuffer& other) : CircularBuffer(other.maxSize) {}
+public:
+    // Up to two contiguous parts of the ring, the second is only used when the range wraps
+    template <class Pointer>
+    struct Regions
+    {
+        Pointer first = nullptr;
+        int firstSize = 0;
+        Pointer second = nullptr;
+        int secondSize = 0;
 
-    void enqueue(T item) {
-        if (isFull())
-            throw std::runtime_error("buffer is full");
+        int size() const { return firstSize + secondSize; }
+    };
 
-        buffer[tail] = item;
+    CircularBuffer(int minimumCapacity = 1) { setCapacity(minimumCapacity); }
 
-        tail = (tail + 1) % maxSize;
+    // Reallocates and empties the ring. Neither thread may be using it
+    void setCapacity(int minimumCapacity)
+    {
+        int capacity = juce::nextPowerOfTwo(juce::jmax(1, minimumCapacity));
+        buffer.assign((size_t)capacity, T());
+        mask = (size_t)capacity - 1;
+        reset();
     }
 
-    T dequeue() {
-        if (isEmpty())
-            throw std::runtime_error("buffer is empty");
-
-        T item = buffer[head];
-
-        buffer[head] = emptyItem;
-
-        head = (head + 1) % maxSize;
-
-        return item;
+    // Empties the ring. Neither thread may be using it
+    void reset()
+    {
+        writePosition.store(0);
+        readPosition.store(0);
     }
 
-    void enqueueBuffer(T* samples, int size) {
-        jassert(size() + size <= maxSize);
-        
-        // base case
-        if (size <= 0)
-            return;
-
-        // Number of samples until end of buffer, or until we hit the head
-        const unsigned numSamplesLeft = (tail >= head) ? maxSize - tail : head - tail;
-
-        // Take the minimum of the samples left or the number of samples requested to copy
-        unsigned numSamples = std::min(numSamplesLeft, size);
+    int getCapacity() const { return (int)buffer.size(); }
 
-        // Copy to tail of buffer
-        std::memcpy(buffer + tail, samples, numSamples);
+    //==============================================================================
+    // Producer
 
-        // Move tail
-        tail = (tail + numSamples) % maxSize;
-
-        // Recursive call
-        enqueueBuffer(samples + numSamples, size - numSamples);
+    int getFreeSpace() const
+    {
+        return getCapacity() - (int)(writePosition.load(std::memory_order_relaxed) - readPosition.load(std::memory_order_acquire));
     }
 
-    void clear() {
-        head = 0;
-        tail = 0;
-        std::memset(buffer.get(), emptyItem, maxSize);
+    // The free space for up to numItems, to be filled in place and then committed with finishedWrite
+    Regions<T*> prepareToWrite(int numItems)
+    {
+        const size_t write = writePosition.load(std::memory_order_relaxed);
+        return getRegions<T*>(buffer.data(), write, juce::jmin(numItems, getFreeSpace()));
     }
 
-    const T& front() {
-        return buffer[head];
+    void finishedWrite(int numItems)
+    {
+        jassert(numItems <= getFreeSpace());
+        writePosition.store(writePosition.load(std::memory_order_relaxed) + (size_t)numItems, std::memory_order_release);
     }
 
-    bool isEmpty() {
-        return head == tail;
+    // Copy in as many items as fit, returning how many were written
+    int write(const T* items, int numItems)
+    {
+        Regions<T*> regions = prepareToWrite(numItems);
+        std::copy(items, items + regions.firstSize, regions.first);
+        std::copy(items + regions.firstSize, items + regions.size(), regions.second);
+        finishedWrite(regions.size());
+        return regions.size();
     }
 
-    bool isFull() {
-        return (tail + 1) % maxSize == head;
+    // Write numItems copies of value, or as many as fit
+    int fill(const T& value, int numItems)
+    {
+        Regions<T*> regions = prepareToWrite(numItems);
+        std::fill(regions.first, regions.first + regions.firstSize, value);
+        std::fill(regions.second, regions.second + regions.secondSize, value);
+        finishedWrite(regions.size());
+        return regions.size();
     }
 
-    int size() {
-        if (tail >= head)
-            return tail - head;
-        return maxSize - (head - tail);
+    //==============================================================================
+    // Consumer
+
+    int getNumReady() const
+    {
+        return (int)(writePosition.load(std::memory_order_acquire) - readPosition.load(std::memory_order_relaxed));
     }
 
-    T* getBuffer() {
-        return buffer.get();
+    // The oldest numItems, or as many as are ready, without taking them out of the ring
+    Regions<const T*> prepareToRead(int numItems) const
+    {
+        const size_t read = readPosition.load(std::memory_order_relaxed);
+        return getRegions<const T*>(buffer.data(), read, juce::jmin(numItems, getNumReady()));
     }
 
-    std::vector<T> toVector()
+    void finishedRead(int numItems)
     {
-        std::vector<T> result;
-        int curr = head;
-        while (curr != tail)
-        {
-            result.push_back(buffer[curr]);
-            curr = (curr + 1) % maxSize;
-        }
-        return result;
+        jassert(numItems <= getNumReady());
+        readPosition.store(readPosition.load(std::memory_order_relaxed) + (size_t)numItems, std::memory_order_release);
     }
 
-    T& operator[](unsigned i)
+    // Copy out as many items as are ready, returning how many were read
+    int read(T* items, int numItems)
     {
-        int index = (head + i) % maxSize;
-        return buffer[index];
+        Regions<const T*> regions = prepareToRead(numItems);
+        std::copy(regions.first, regions.first + regions.firstSize, items);
+        std::copy(regions.second, regions.second + regions.secondSize, items + regions.firstSize);
+        finishedRead(regions.size());
+        return regions.size();
     }
 
-    //const T& operator[](unsigned i)
-    //{
-    //    int index = (head + i) % maxSize;
-    //    return buffer[index];
-    //}
+    // Drop the oldest items, returning how many were dropped
+    int discard(int numItems)
+    {
+        int numDiscarded = juce::jmin(numItems, getNumReady());
+        finishedRead(numDiscarded);
+        return numDiscarded;
+    }
 
 private:
-    std::unique_ptr<T[]> buffer;
-
-    int head = 0;
-    int tail = 0;
-    int maxSize;
-    T emptyItem = 0;
-};
+    template <class Pointer>
+    Regions<Pointer> getRegions(Pointer storage, size_t position, int numItems) const
+    {
+        const int start = (int)(position & mask);
+
+        Regions<Pointer> regions;
+        regions.first = storage + start;
+        regions.firstSize = juce::jmin(numItems, getCapacity() - start);
+        regions.second = storage;
+        regions.secondSize = numItems - regions.firstSize;
+        return regions;
+    }
 
+    std::vector<T> buffer;
+    size_t mask = 0;
 
+    // Each position is only written by one thread, so they sit on separate cache lines
+    static constexpr size_t cacheLineSize = 64;
+    alignas(cacheLineSize) std::atomic<size_t> writePosition { 0 };
+    alignas(cacheLineSize) std::atomic<size_t> readPosition { 0 };
+};
@@ -0,0 +1,275 @@
+/*
+  ==============================================================================
+
+    FFTBackend.cpp
+    Created: 9 May 2022 10:42:05am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "FFTBackend.h"
+#include "MixedRadixFFT.h"
+#include <map>
+#include <random>
+
+
+void FFTBackend::performRealOnlyForwardTransform(const float* input, float* output) const
+{
+    std::copy(input, input + size, output);
+    performRealOnlyForwardTransform(output);
+}
+
+std::unique_ptr<FFTBackend> FFTBackend::create(int size, Type type)
+{
+    switch (resolveType(size, type))
+    {
+        case juceEngine: return std::make_unique<JuceFFTBackend>(size);
+        case splitRadix: return std::make_unique<SplitRadixFFT>(size);
+        case automatic:
+        case mixedRadix:
+        case numTypes:
+        default:         return std::make_unique<MixedRadixFFT>(size);
+    }
+}
+
+bool FFTBackend::supportsSize(Type type, int size)
+{
+    switch (type)
+    {
+        case juceEngine:
+        case splitRadix: return size >= 2 && juce::isPowerOfTwo(size);
+        case mixedRadix:
+        case automatic:  return MixedRadixFFT::isSupportedSize(size);
+        case numTypes:
+        default:         return false;
+    }
+}
+
+const char* FFTBackend::getTypeName(Type type)
+{
+    switch (type)
+    {
+        case automatic:  return "Automatic";
+        case juceEngine: return "JUCE";
+        case splitRadix: return "Split Radix";
+        case mixedRadix: return "Mixed Radix";
+        case numTypes:
+        default:         return "Unknown";
+    }
+}
+
+namespace
+{
+    // The fastest type of each size selectFastestTypes has timed
+    juce::CriticalSection fastestTypesLock;
+    std::map<int, FFTBackend::Type> fastestTypes;
+}
+
+// Never times anything, so it is cheap enough to call under a lock. A size that hasn't been timed yet falls back to
+// the JUCE engine, or to the mixed radix engine for the sizes only it can do
+FFTBackend::Type FFTBackend::resolveType(int size, Type type)
+{
+    if (type != automatic && supportsSize(type, size))
+        return type;
+
+    {
+        const juce::ScopedLock scopedLock(fastestTypesLock);
+        auto fastest = fastestTypes.find(size);
+        if (fastest != fastestTypes.end())
+            return fastest->second;
+    }
+    return supportsSize(juceEngine, size) ? juceEngine : mixedRadix;
+}
+
+// The timing runs without the lock, so engines can still be resolved while it is under way
+void FFTBackend::selectFastestTypes(int firstOrder, int lastOrder)
+{
+    for (int order = firstOrder; order <= lastOrder; ++order)
+    {
+        const int size = 1 << order;
+        {
+            const juce::ScopedLock scopedLock(fastestTypesLock);
+            if (fastestTypes.count(size) > 0)
+                continue;
+        }
+
+        const Type fastest = benchmarkTypes(size);
+        const juce::ScopedLock scopedLock(fastestTypesLock);
+        fastestTypes.emplace(size, fastest);
+    }
+}
+
+// Time a forward and inverse transform with each type that can do the size. The best of a few short runs
+// is kept for each, so a run that was interrupted doesn't count against a type
+FFTBackend::Type FFTBackend::benchmarkTypes(int size)
+{
+    std::vector<float> data((size_t)(2 * size));
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    Type fastestType = mixedRadix;
+    double fastestTime = std::numeric_limits<double>::max();
+
+    for (int t = automatic + 1; t < numTypes; ++t)
+    {
+        const Type type = (Type)t;
+        if (!supportsSize(type, size))
+            continue;
+
+        std::unique_ptr<FFTBackend> engine = create(size, type);
+        const int iterations = juce::jmax(1, (1 << 16) / size);
+        double bestTime = std::numeric_limits<double>::max();
+
+        for (int run = 0; run < 4; ++run)
+        {
+            for (float& x : data)
+                x = dist(rng);
+
+            const double start = juce::Time::getMillisecondCounterHiRes();
+            for (int i = 0; i < iterations; ++i)
+            {
+                engine->performRealOnlyForwardTransform(data.data());
+                engine->performRealOnlyInverseTransform(data.data());
+            }
+            bestTime = juce::jmin(bestTime, juce::Time::getMillisecondCounterHiRes() - start);
+        }
+
+        if (bestTime < fastestTime)
+        {
+            fastestTime = bestTime;
+            fastestType = type;
+        }
+    }
+
+    return fastestType;
+}
+
+
+//==============================================================================
+PackedRealFFT::PackedRealFFT(int fftSize)
+    : FFTBackend(fftSize), halfSize(fftSize / 2)
+{
+    jassert(fftSize >= 2 && fftSize % 2 == 0);
+
+    const double pi = juce::MathConstants<double>::pi;
+    twiddles.resize((size_t)halfSize);
+    for (size_t k = 0; k < twiddles.size(); ++k)
+        twiddles[k] = Complex(std::polar(1.0, -2.0 * pi * (double)k / halfSize));
+
+    realTwiddles.resize((size_t)halfSize + 1);
+    for (size_t k = 0; k < realTwiddles.size(); ++k)
+        realTwiddles[k] = Complex(std::polar(1.0, -2.0 * pi * (double)k / size));
+
+    scratch.resize((size_t)halfSize);
+}
+
+// Transform the packed samples, then split the result into the spectra of the even and odd samples and
+// combine those into the real spectrum
+void PackedRealFFT::performRealOnlyForwardTransform(float* data) const
+{
+    Complex* packed = reinterpret_cast<Complex*>(data);
+    transform(scratch.data(), packed);
+
+    for (int k = 0; k <= halfSize; ++k)
+    {
+        const Complex z = scratch[(size_t)(k % halfSize)];
+        const Complex mirrored = std::conj(scratch[(size_t)((halfSize - k) % halfSize)]);
+        const Complex even = 0.5f * (z + mirrored);
+        const Complex difference = z - mirrored;
+        const Complex odd(0.5f * difference.imag(), -0.5f * difference.real());
+        packed[k] = even + multiply(realTwiddles[(size_t)k], odd);
+    }
+}
+
+// The reverse of the forward split. The inverse complex transform is the forward one on conjugates
+void PackedRealFFT::performRealOnlyInverseTransform(float* data) const
+{
+    Complex* packed = reinterpret_cast<Complex*>(data);
+    for (int k = 0; k < halfSize; ++k)
+    {
+        const Complex x = packed[k];
+        const Complex mirrored = std::conj(packed[halfSize - k]);
+        const Complex even = 0.5f * (x + mirrored);
+        const Complex odd = multiply(0.5f * (x - mirrored), std::conj(realTwiddles[(size_t)k]));
+        scratch[(size_t)k] = std::conj(even + Complex(-odd.imag(), odd.real()));
+    }
+
+    transform(packed, scratch.data());
+
+    const float scale = 1.f / (float)halfSize;
+    for (int k = 0; k < halfSize; ++k)
+        packed[k] = Complex(packed[k].real() * scale, -packed[k].imag() * scale);
+}
+
+
+//==============================================================================
+JuceFFTBackend::JuceFFTBackend(int fftSize)
+    : FFTBackend(fftSize), fft(juce::findHighestSetBit((juce::uint32)fftSize))
+{
+    jassert(juce::isPowerOfTwo(fftSize));
+}
+
+void JuceFFTBackend::performRealOnlyForwardTransform(float* data) const
+{
+    fft.performRealOnlyForwardTransform(data, true);
+}
+
+void JuceFFTBackend::performRealOnlyInverseTransform(float* data) const
+{
+    fft.performRealOnlyInverseTransform(data);
+}
+
+
+//==============================================================================
+SplitRadixFFT::SplitRadixFFT(int fftSize)
+    : PackedRealFFT(fftSize)
+{
+    jassert(juce::isPowerOfTwo(fftSize));
+}
+
+void SplitRadixFFT::transform(Complex* output, const Complex* input) const
+{
+    transform(output, input, halfSize, 1);
+}
+
+// The even samples make a transform of half the length and the odd ones two of a quarter, stored one after
+// another in output. Their twiddles are every stride-th entry of the table for the full length
+void SplitRadixFFT::transform(Complex* output, const Complex* input, int length, int stride) const
+{
+    if (length == 1)
+    {
+        output[0] = input[0];
+        return;
+    }
+    if (length == 2)
+    {
+        output[0] = input[0] + input[stride];
+        output[1] = input[0] - input[stride];
+        return;
+    }
+
+    const int half = length / 2;
+    const int quarter = length / 4;
+    transform(output, input, half, 2 * stride);
+    transform(output + half, input + stride, quarter, 4 * stride);
+    transform(output + half + quarter, input + (3 * stride), quarter, 4 * stride);
+
+    for (int k = 0; k < quarter; ++k)
+    {
+        const Complex z1 = multiply(output[k + half], twiddles[(size_t)(k * stride)]);
+        const Complex z3 = multiply(output[k + half + quarter], twiddles[(size_t)(3 * k * stride)]);
+        const Complex sum = z1 + z3;
+        const Complex difference = z1 - z3;
+
+        // -i * (z1 - z3)
+        const Complex rotated(difference.imag(), -difference.real());
+
+        const Complex even = output[k];
+        const Complex evenQuarter = output[k + quarter];
+        output[k] = even + sum;
+        output[k + half] = even - sum;
+        output[k + quarter] = evenQuarter + rotated;
+        output[k + half + quarter] = evenQuarter - rotated;
+    }
+}
@@ -0,0 +1,131 @@
+/*
+  ==============================================================================
+
+    FFTBackend.h
+    Created: 9 May 2022 10:42:05am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_dsp/juce_dsp.h>
+#include <complex>
+#include <memory>
+#include <vector>
+
+
+// A real FFT engine of one size. Spectra use the layout of juce::dsp::FFT's real-only transforms, the
+// size / 2 + 1 non-negative frequencies as interleaved (real, imag) floats, and the inverse is scaled by
+// 1 / size. Engines may keep scratch space, so only one thread may use an instance at a time
+class FFTBackend
+{
+public:
+    enum Type
+    {
+        automatic = 0,
+        juceEngine,
+        splitRadix,
+        mixedRadix,
+        numTypes
+    };
+
+    virtual ~FFTBackend() = default;
+
+    int getSize() const { return size; }
+    virtual Type getType() const = 0;
+
+    // In place on 2 * size floats
+    virtual void performRealOnlyForwardTransform(float* data) const = 0;
+    virtual void performRealOnlyInverseTransform(float* data) const = 0;
+
+    // Out of place, input holds size samples and output 2 * size floats. Copies and transforms in place unless an engine does better
+    virtual void performRealOnlyForwardTransform(const float* input, float* output) const;
+
+    // Builds an engine of the given type, or of the type resolveType picks for the size if the type is automatic or can't do the size
+    static std::unique_ptr<FFTBackend> create(int size, Type type = automatic);
+
+    // The type create would build. Automatic is the fastest type for sizes selectFastestTypes has timed, and the JUCE
+    // engine for other power of two sizes until they are
+    static Type resolveType(int size, Type type);
+    static bool supportsSize(Type type, int size);
+    static const char* getTypeName(Type type);
+
+    // Times every type for each power of two size in the range. This takes a while, so keep it off the message thread.
+    // Other sizes are left out, only the mixed radix engine can do them
+    static void selectFastestTypes(int firstOrder, int lastOrder);
+
+protected:
+    explicit FFTBackend(int fftSize) : size(fftSize) {}
+
+    const int size;
+
+private:
+    static Type benchmarkTypes(int size);
+};
+
+
+// A real FFT of an even size done as a complex transform of half the size, the even samples as the real
+// parts and the odd ones as the imaginary parts. Engines only provide the complex transform
+class PackedRealFFT : public FFTBackend
+{
+public:
+    void performRealOnlyForwardTransform(float* data) const override;
+    void performRealOnlyInverseTransform(float* data) const override;
+    using FFTBackend::performRealOnlyForwardTransform;
+
+protected:
+    typedef std::complex<float> Complex;
+
+    explicit PackedRealFFT(int fftSize);
+
+    // Forward complex transform of halfSize samples, output and input never overlap
+    virtual void transform(Complex* output, const Complex* input) const = 0;
+
+    // Written out since std::complex multiplication checks for infinities unless fast math is on
+    static Complex multiply(Complex a, Complex b)
+    {
+        return { (a.real() * b.real()) - (a.imag() * b.imag()), (a.real() * b.imag()) + (a.imag() * b.real()) };
+    }
+
+    const int halfSize;
+
+    // exp(-2 pi i k / halfSize) for the complex passes
+    std::vector<Complex> twiddles;
+
+private:
+    // exp(-2 pi i k / size) for splitting the complex spectrum into the real one
+    std::vector<Complex> realTwiddles;
+    mutable std::vector<Complex> scratch;
+};
+
+
+// juce::dsp::FFT, which uses whichever engine JUCE was built with. Powers of two only
+class JuceFFTBackend : public FFTBackend
+{
+public:
+    explicit JuceFFTBackend(int fftSize);
+
+    Type getType() const override { return juceEngine; }
+    void performRealOnlyForwardTransform(float* data) const override;
+    void performRealOnlyInverseTransform(float* data) const override;
+    using FFTBackend::performRealOnlyForwardTransform;
+
+private:
+    juce::dsp::FFT fft;
+};
+
+
+// Split radix decimation in time, a radix 2 pass on the even samples and radix 4 on the odd ones,
+// which needs the fewest multiplies of the power of two algorithms. Powers of two only
+class SplitRadixFFT : public PackedRealFFT
+{
+public:
+    explicit SplitRadixFFT(int fftSize);
+
+    Type getType() const override { return splitRadix; }
+
+private:
+    void transform(Complex* output, const Complex* input) const override;
+    void transform(Complex* output, const Complex* input, int length, int stride) const;
+};
@@ -286,6 +286,7 @@ void FileManager::checkForPathToOpen()
 
                 playFileButton.setEnabled(true);
                 resetButton.setEnabled(true);
+                saveButton.setEnabled(true);
 
                 mainComponent->speechEnhancer.onFileLoaded();
             }
@@ -318,7 +319,10 @@ void FileManager::onButtonChange(juce::Button* button)
     }
     else if (button == &saveButton)
     {
-        AudioSampleBuffer* outputBuffer = mainComponent->speechEnhancer.getOutputBuffer();
+        // Render the whole file offline rather than saving whatever has been played
+        AudioSampleBuffer* outputBuffer = nullptr;
+        if (currentBuffer.get() != nullptr)
+            outputBuffer = mainComponent->speechEnhancer.renderFile(*currentBuffer.get()->getAudioSampleBuffer());
         if (outputBuffer != nullptr)
         {
             saveWavFile(outputBuffer, "output", rate);
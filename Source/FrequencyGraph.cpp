@@ -13,7 +13,7 @@
 
 //==============================================================================
 template <class T>
-FrequencyGraph<T>::FrequencyGraph(int order) : fftSize(1 << order), fftOrder(order), forwardFFT(nullptr), window(nullptr)
+FrequencyGraph<T>::FrequencyGraph(int order) : fftSize(1 << order), fftOrder(order), window(nullptr)
 {
     startTimerHz(60);
     setOrder(order);
@@ -31,9 +31,6 @@ FrequencyGraph<T>::FrequencyGraph(int order) : fftSize(1 << order), fftOrder(ord
 template <class T>
 FrequencyGraph<T>::~FrequencyGraph()
 {
-    if (forwardFFT != nullptr)
-        delete forwardFFT;
-
     if (window != nullptr)
         delete window;
 }
@@ -80,12 +77,8 @@ void FrequencyGraph<T>::resized()
 template <class T>
 void FrequencyGraph<T>::setOrder(int order)
 {
-    if (forwardFFT != nullptr)
-    {
-        delete forwardFFT;
-    }
-    forwardFFT = new juce::dsp::FFT(order);
     fftSize = 1 << order;
+    forwardFFT = FFTBackend::create(fftSize);
 
     if (window != nullptr)
     {
@@ -94,79 +87,61 @@ void FrequencyGraph<T>::setOrder(int order)
     window = new juce::dsp::WindowingFunction<T>(fftSize, juce::dsp::WindowingFunction<T>::hann);
 
     fftOrder = order;
-    fifo.clear();
-    fifo.resize(fftSize);
+
+    // Room for a few frames, so the audio thread can keep writing between timer callbacks
+    fifo.setCapacity(4 * fftSize);
     fftData.clear();
     fftData.resize(fftSize);
+    spectrum.assign(2 * fftSize, 0.f);
     scopeData.clear();
     scopeData.resize(scopeSize);
 }
 
+// Called on the audio thread. Samples that don't fit while the message thread is behind are dropped
 template <class T>
 void FrequencyGraph<T>::processBuffer(const juce::AudioSourceChannelInfo& bufferToFill)
 {
     if (bufferToFill.buffer->getNumChannels() > 0)
-    {
-        const float* buffer = bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample);
-        for (int i = 0; i < bufferToFill.numSamples; ++i)
-        {
-            pushNextSample(buffer[i]);
-        }
-    }
-}
-
-template <class T>
-void FrequencyGraph<T>::pushNextSample(float sample)
-{
-    if (fifoIndex == fftSize)
-    {
-        if (!nextFFTBlockReady)
-        {
-            clear();
-        }
-        fifoIndex = 0;
-    }
-    fifo[fifoIndex++] = sample;
+        fifo.write(bufferToFill.buffer->getReadPointer(0, bufferToFill.startSample), bufferToFill.numSamples);
 }
 
+// Drop any samples waiting to be drawn and blank the graph
 template <class T>
 void FrequencyGraph<T>::clear()
 {
+    fifo.discard(fifo.getNumReady());
     std::fill(fftData.begin(), fftData.end(), (T)0.f);
-    std::copy(fifo.begin(), fifo.end(), fftData.begin());
-    //juce::zeromem(&fftData[0], fftData.size());
-    //std::memcpy(&fftData[0], &fifo[0], fifo.size());
-    nextFFTBlockReady = true;
+    std::fill(scopeData.begin(), scopeData.end(), (T)0.f);
+    repaint();
 }
 
 template <class T>
 void FrequencyGraph<T>::drawNextFrameOfSpectrum()
 {
     window->multiplyWithWindowingTable(&fftData[0], fftSize);
-    //forwardFFT->performFrequencyOnlyForwardTransform(&fftData[0]);
-    std::vector<juce::dsp::Complex<float>> input;
-    for (int i = 0; i < fftSize; ++i)
-    {
-        input.push_back(juce::dsp::Complex<float>((float)fftData[i], 0));
-    }
-    std::vector<juce::dsp::Complex<float>> output(fftSize);
-    forwardFFT->perform(&input[0], &output[0], false);
+    std::copy(fftData.begin(), fftData.end(), spectrum.begin());
+    forwardFFT->performRealOnlyForwardTransform(&spectrum[0]);
 
+    // Only the non-negative frequencies are transformed, the rest mirror them
     for (int i = 0; i < fftSize; ++i)
     {
-        fftData[i] = std::sqrt((output[i].real() * output[i].real()) + (output[i].imag() * output[i].imag()));
+        int bin = i <= fftSize / 2 ? i : fftSize - i;
+        fftData[i] = std::sqrt((spectrum[2 * bin] * spectrum[2 * bin]) + (spectrum[2 * bin + 1] * spectrum[2 * bin + 1]));
     }
 
     setScopedData();
 }
 
+// Draw the newest full frame the audio thread has written, older samples are skipped
 template <class T>
 void FrequencyGraph<T>::timerCallback()
 {
-    if (nextFFTBlockReady)
+    int numReady = fifo.getNumReady();
+    if (numReady >= fftSize)
     {
+        fifo.discard(numReady - fftSize);
+        fifo.read(&fftData[0], fftSize);
         drawNextFrameOfSpectrum();
-        nextFFTBlockReady = false;
         repaint();
     }
 }
@@ -254,10 +229,13 @@ void FrequencyGraph<T>::setScopedData()
 {
     float maxdB = 0.0f;
 
+    // Externally added data may be a half spectrum, so index by what is actually stored
+    int numPoints = fftData.size();
+
     for (int i = 0; i < scopeSize; ++i)
     {
         float skewedProportionX = 1.0f - std::exp(std::log(1.0f - (float)i / (float)scopeSize) * skew);
-        int fftDataIndex = juce::jlimit(0, fftSize, (int)(skewedProportionX * (float)fftSize));
+        int fftDataIndex = juce::jlimit(0, numPoints - 1, (int)(skewedProportionX * (float)numPoints));
         float level = juce::jmap(juce::jlimit((float)minimumdB, maxdB, (juce::Decibels::gainToDecibels((float)fftData[fftDataIndex])
             - juce::Decibels::gainToDecibels((float)fftSize))),
             (float)minimumdB, maxdB, 0.0f, 1.0f);
@@ -11,6 +11,8 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "CircularBuffer.h"
+#include "FFTBackend.h"
 
 //==============================================================================
 /*
@@ -27,7 +29,6 @@ public:
 
     void setOrder(int order);
     void processBuffer(const juce::AudioSourceChannelInfo& bufferToFill);
-    void pushNextSample(float sample);
     void addFrequencyData(const juce::AudioSampleBuffer& frequencyData);
     void addFrequencyData(const std::vector<T>& frequencyData);
 
@@ -46,13 +47,13 @@ private:
     float minimumdB = -100;
     float minFrequency = 20.f;
     float maxFrequency = 20000.f;
-    juce::dsp::FFT* forwardFFT;
+    std::unique_ptr<FFTBackend> forwardFFT;
     juce::dsp::WindowingFunction<T>* window;
-    std::vector<T> fifo;
+    // Written by the audio thread, drained by the timer on the message thread
+    CircularBuffer<T> fifo;
     std::vector<T> fftData;
+    std::vector<float> spectrum;
     std::vector<T> scopeData;
-    int fifoIndex = 0;
-    bool nextFFTBlockReady = false;
     float samplingRate = 48000.f;
     int numFrequencyBands = 1;
     double skew = 0.2;
@@ -69,6 +69,10 @@ InputManager::InputManager() : inputGraph(), frequencyGraph(11)
     latencyLabel.setText("Latency: 0.0 ms", juce::NotificationType::dontSendNotification);
     latencyLabel.setJustificationType(juce::Justification::centredLeft);
 
+    addAndMakeVisible(underrunLabel);
+    underrunLabel.setText("Underruns: 0 samples", juce::NotificationType::dontSendNotification);
+    underrunLabel.setJustificationType(juce::Justification::centredLeft);
+
 
     addAndMakeVisible(fileManager);
     addChildComponent(microphoneManager);
@@ -137,7 +141,8 @@ void InputManager::resized()
     gainSlider.setBounds(width * 0.3f, height * 0.05f, width * 0.4f, height * 0.075f);
 
     muteOutputButton.setBounds(width * 0.7f, height * 0.02f, width * 0.25f, height * 0.05f);
-    latencyLabel.setBounds(width * 0.7f, height * 0.08f, width * 0.25f, height * 0.05f);
+    latencyLabel.setBounds(width * 0.7f, height * 0.07f, width * 0.25f, height * 0.04f);
+    underrunLabel.setBounds(width * 0.7f, height * 0.11f, width * 0.25f, height * 0.04f);
 }
 
 void InputManager::onButtonPress(juce::Button* button)
@@ -193,3 +198,12 @@ void InputManager::setLatency(float latency)
 
     latencyLabel.setText(latencyText.str(), juce::NotificationType::dontSendNotification);
 }
+
+// Samples of silence the output stream has played since it started because processing fell behind
+void InputManager::setUnderruns(juce::int64 numSamples)
+{
+    std::stringstream underrunText;
+    underrunText << "Underruns: " << numSamples << " samples";
+
+    underrunLabel.setText(underrunText.str(), juce::NotificationType::dontSendNotification);
+}
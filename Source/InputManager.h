@@ -48,6 +48,7 @@ public:
     void setInputGraph(juce::AudioSampleBuffer* buffer);
 
     void setLatency(float latency);
+    void setUnderruns(juce::int64 numSamples);
 
     FileManager fileManager;
     MicrophoneManager microphoneManager;
@@ -73,6 +74,7 @@ private:
     FrequencyGraph<float> frequencyGraph;
 
     juce::Label latencyLabel;
+    juce::Label underrunLabel;
 
     float inputGain = 1.f;
 
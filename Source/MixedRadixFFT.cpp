@@ -0,0 +1,143 @@
+/*
+  ==============================================================================
+
+    MixedRadixFFT.cpp
+    Created: 2 May 2022 3:18:27pm
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "MixedRadixFFT.h"
+
+
+MixedRadixFFT::MixedRadixFFT(int fftSize)
+    : PackedRealFFT(fftSize)
+{
+    jassert(isSupportedSize(fftSize));
+
+    // Radix 4 passes first since they are cheapest per sample, the odd radices last
+    int remaining = halfSize;
+    for (int radix : { 4, 2, 3, 5 })
+    {
+        while (remaining % radix == 0 && remaining > 1)
+        {
+            remaining /= radix;
+            radices.push_back(radix);
+            spans.push_back(remaining);
+        }
+    }
+}
+
+bool MixedRadixFFT::isSupportedSize(int size)
+{
+    if (size < 2 || size % 2 != 0)
+        return false;
+
+    int remaining = size / 2;
+    for (int radix : { 2, 3, 5 })
+    {
+        while (remaining % radix == 0)
+            remaining /= radix;
+    }
+    return remaining == 1;
+}
+
+int MixedRadixFFT::nextSupportedSize(int size)
+{
+    int supported = juce::jmax(2, size);
+    while (!isSupportedSize(supported))
+        ++supported;
+    return supported;
+}
+
+
+// A size of two needs no passes
+void MixedRadixFFT::transform(Complex* output, const Complex* input) const
+{
+    if (radices.empty())
+        output[0] = input[0];
+    else
+        transform(output, input, 1, 0);
+}
+
+// Decimation in time. Each of the radix sub-transforms reads every radix-th input sample into its own
+// contiguous part of output, then one butterfly pass combines them
+void MixedRadixFFT::transform(Complex* output, const Complex* input, int stride, int stage) const
+{
+    const int radix = radices[(size_t)stage];
+    const int span = spans[(size_t)stage];
+    Complex* const end = output + (radix * span);
+
+    if (span == 1)
+    {
+        for (Complex* o = output; o != end; ++o, input += stride)
+            *o = *input;
+    }
+    else
+    {
+        for (Complex* o = output; o != end; o += span, input += stride)
+            transform(o, input, stride * radix, stage + 1);
+    }
+
+    butterfly(output, stride, radix, span);
+}
+
+// Combine radix transforms of length span, stored one after another, into one of length radix * span
+void MixedRadixFFT::butterfly(Complex* output, int stride, int radix, int span) const
+{
+    const Complex* tw = twiddles.data();
+
+    if (radix == 2)
+    {
+        for (int u = 0; u < span; ++u)
+        {
+            const Complex a = output[u];
+            const Complex b = multiply(output[u + span], tw[u * stride]);
+            output[u] = a + b;
+            output[u + span] = a - b;
+        }
+    }
+    else if (radix == 4)
+    {
+        for (int u = 0; u < span; ++u)
+        {
+            const Complex t0 = output[u];
+            const Complex t1 = multiply(output[u + span], tw[u * stride]);
+            const Complex t2 = multiply(output[u + (2 * span)], tw[2 * u * stride]);
+            const Complex t3 = multiply(output[u + (3 * span)], tw[3 * u * stride]);
+
+            const Complex sum02 = t0 + t2;
+            const Complex difference02 = t0 - t2;
+            const Complex sum13 = t1 + t3;
+            const Complex difference13 = t1 - t3;
+
+            // -i * (t1 - t3)
+            const Complex rotated(difference13.imag(), -difference13.real());
+
+            output[u] = sum02 + sum13;
+            output[u + span] = difference02 + rotated;
+            output[u + (2 * span)] = sum02 - sum13;
+            output[u + (3 * span)] = difference02 - rotated;
+        }
+    }
+    else
+    {
+        // Radix 3 and 5 as a direct DFT of the twiddled inputs, the roots of unity are every (stride * span)-th twiddle
+        const int rootStride = stride * span;
+        Complex inputs[5];
+        for (int u = 0; u < span; ++u)
+        {
+            for (int q = 0; q < radix; ++q)
+                inputs[q] = multiply(output[u + (q * span)], tw[q * u * stride]);
+
+            for (int k = 0; k < radix; ++k)
+            {
+                Complex sum = inputs[0];
+                for (int q = 1; q < radix; ++q)
+                    sum += multiply(inputs[q], tw[((k * q) % radix) * rootStride]);
+                output[u + (k * span)] = sum;
+            }
+        }
+    }
+}
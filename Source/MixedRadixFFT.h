@@ -0,0 +1,37 @@
+/*
+  ==============================================================================
+
+    MixedRadixFFT.h
+    Created: 2 May 2022 3:18:27pm
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include "FFTBackend.h"
+
+
+// A real FFT for even sizes whose half has no prime factor above 5, such as 480 and 960. The complex
+// transform of half the size is split into radix 4, 2, 3 and 5 passes
+class MixedRadixFFT : public PackedRealFFT
+{
+public:
+    explicit MixedRadixFFT(int fftSize);
+
+    static bool isSupportedSize(int size);
+
+    // The smallest supported size that is at least size
+    static int nextSupportedSize(int size);
+
+    Type getType() const override { return mixedRadix; }
+
+private:
+    void transform(Complex* output, const Complex* input) const override;
+    void transform(Complex* output, const Complex* input, int stride, int stage) const;
+    void butterfly(Complex* output, int stride, int radix, int span) const;
+
+    // Radix of each pass, and the length of the transforms it combines
+    std::vector<int> radices;
+    std::vector<int> spans;
+};
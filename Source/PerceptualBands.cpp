@@ -0,0 +1,107 @@
+/*
+  ==============================================================================
+
+    PerceptualBands.cpp
+    Created: 23 May 2022 4:11:02pm
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "PerceptualBands.h"
+#include "SpectralKernels.h"
+#include <cmath>
+#include <functional>
+
+
+namespace
+{
+    // ERB rate of Glasberg and Moore, the number of equivalent rectangular bandwidths below a frequency
+    double frequencyToERB(double hz) { return 21.4 * std::log10(1.0 + (0.00437 * hz)); }
+    double erbToFrequency(double erb) { return (std::pow(10.0, erb / 21.4) - 1.0) / 0.00437; }
+}
+
+
+PerceptualBands::PerceptualBands(int bins, float sampleRate, int numBands)
+    : numBins(bins), rate(sampleRate), requestedBands(numBands)
+{
+    // Every edge needs a bin of its own
+    const int bands = juce::jlimit(1, juce::jmax(1, numBins - 2), numBands);
+    const size_t numEdges = (size_t)bands + 2;
+    const double nyquist = sampleRate / 2.0;
+    const double binsPerHz = (numBins - 1) / nyquist;
+    const double topERB = frequencyToERB(nyquist);
+
+    // Even on the ERB scale from DC to the Nyquist bin, then pushed up to a bin apart and back down below the Nyquist bin
+    std::vector<double> edges(numEdges);
+    for (size_t i = 0; i < numEdges; ++i)
+        edges[i] = erbToFrequency((topERB * (double)i) / (double)(numEdges - 1)) * binsPerHz;
+    for (size_t i = 1; i < numEdges; ++i)
+        edges[i] = juce::jmax(edges[i], edges[i - 1] + 1.0);
+    edges[numEdges - 1] = numBins - 1;
+    for (size_t i = numEdges - 1; i > 0; --i)
+        edges[i - 1] = juce::jmin(edges[i - 1], edges[i] - 1.0);
+
+    centres.resize((size_t)bands);
+    for (size_t b = 0; b < centres.size(); ++b)
+        centres[b] = (float)edges[b + 1];
+
+    // Segment i starts on the first bin above edge i, the last segment ends on the Nyquist bin
+    risingWeights.assign((size_t)numBins, 0.f);
+    for (size_t i = 0; i < numEdges; ++i)
+        segmentStarts.push_back((int)std::floor(edges[i]) + 1);
+    for (size_t i = 0; i < numEdges - 1; ++i)
+    {
+        for (int k = segmentStarts[i]; k < segmentStarts[i + 1]; ++k)
+            risingWeights[(size_t)k] = (float)((k - edges[i]) / (edges[i + 1] - edges[i]));
+    }
+
+    // Band b rises across segment b and falls across segment b + 1
+    bandScales.resize((size_t)bands);
+    for (size_t b = 0; b < bandScales.size(); ++b)
+    {
+        double sum = 0;
+        for (int k = segmentStarts[b]; k < segmentStarts[b + 1]; ++k)
+            sum += risingWeights[(size_t)k];
+        for (int k = segmentStarts[b + 1]; k < segmentStarts[b + 2]; ++k)
+            sum += 1.0 - risingWeights[(size_t)k];
+        bandScales[b] = (float)(1.0 / sum);
+    }
+}
+
+bool PerceptualBands::matches(int bins, float sampleRate, int numBands) const
+{
+    return numBins == bins && std::equal_to<float>()(rate, sampleRate) && requestedBands == numBands;
+}
+
+// Each segment is summed twice, plain and weighted by the rising weights. The falling part is the difference
+void PerceptualBands::binsToBands(const float* bins, float* bands) const
+{
+    float previousRising = 0;
+    for (size_t i = 0; i < segmentStarts.size() - 1; ++i)
+    {
+        const float total = SpectralKernels::sum(bins, segmentStarts[i], segmentStarts[i + 1]);
+        const float rising = SpectralKernels::weightedSum(bins, risingWeights.data(), segmentStarts[i], segmentStarts[i + 1]);
+        if (i > 0)
+            bands[i - 1] = bandScales[i - 1] * (previousRising + total - rising);
+        previousRising = rising;
+    }
+}
+
+// Segment i ramps from band i - 1 to band i. Below the first centre and above the last the bins are flat
+void PerceptualBands::bandsToBins(const float* bands, float* bins) const
+{
+    const int numBands = getNumBands();
+    juce::FloatVectorOperations::fill(bins, bands[0], segmentStarts[1]);
+
+    for (int i = 1; i < numBands; ++i)
+    {
+        const int start = segmentStarts[(size_t)i];
+        const int length = segmentStarts[(size_t)i + 1] - start;
+        juce::FloatVectorOperations::copyWithMultiply(bins + start, risingWeights.data() + start, bands[i] - bands[i - 1], length);
+        juce::FloatVectorOperations::add(bins + start, bands[i - 1], length);
+    }
+
+    const int lastStart = segmentStarts[(size_t)numBands];
+    juce::FloatVectorOperations::fill(bins + lastStart, bands[numBands - 1], numBins - lastStart);
+}
@@ -0,0 +1,50 @@
+/*
+  ==============================================================================
+
+    PerceptualBands.h
+    Created: 23 May 2022 4:11:02pm
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_dsp/juce_dsp.h>
+#include <vector>
+
+
+// Triangular bands spaced evenly on the ERB scale over a half spectrum. Band b rises from edge b to its centre on
+// edge b + 1 and falls to edge b + 2, and each band is the weighted average of the bins under it. Going back, a bin
+// takes the value interpolated linearly between the centres either side of it. Neighbouring edges are kept at least
+// a bin apart, so at small fft sizes the lowest bands are spaced by bins instead
+class PerceptualBands
+{
+public:
+    static constexpr int maxBands = 40;
+
+    PerceptualBands(int numBins, float sampleRate, int numBands);
+
+    bool matches(int numBins, float sampleRate, int numBands) const;
+    int getNumBands() const { return (int)bandScales.size(); }
+    int getNumBins() const { return numBins; }
+    float getCentreBin(int band) const { return centres[(size_t)band]; }
+
+    // bands[b] = the weighted average of the bins under band b
+    void binsToBands(const float* bins, float* bands) const;
+
+    // bins[k] = bands interpolated to bin k
+    void bandsToBins(const float* bands, float* bins) const;
+
+private:
+    int numBins;
+    float rate;
+    int requestedBands;
+    std::vector<float> centres;
+
+    // The bin to band matrix. The bins in (edge i, edge i + 1] form segment i, where band i rises and band i - 1 falls.
+    // A bin's two weights sum to one so only the rising one is kept, and it is also the bin's position between the
+    // two centres. Each band's weights are scaled by bandScales to sum to one
+    std::vector<int> segmentStarts;
+    std::vector<float> risingWeights;
+    std::vector<float> bandScales;
+};
@@ -0,0 +1,183 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.cpp
+    Created: 16 May 2022 9:27:44am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "PolyphaseResampler.h"
+#include <cmath>
+
+
+int PolyphaseFilter::getLength(int factor)
+{
+    return tapsPerPhase * factor;
+}
+
+// Blackman windowed sinc with unity gain at DC. The transition band is about 5.5 / length wide, it is
+// placed so the stopband starts at the lower rate's Nyquist frequency and nothing above it aliases down
+std::vector<float> PolyphaseFilter::designLowpass(int factor)
+{
+    const int length = getLength(factor);
+    const double pi = juce::MathConstants<double>::pi;
+    const double cutoff = (0.5 / factor) - (2.75 / length);
+    const double centre = (length - 1) / 2.0;
+
+    std::vector<double> taps((size_t)length);
+    double sum = 0;
+    for (int k = 0; k < length; ++k)
+    {
+        const double t = k - centre;
+        const double sinc = 2.0 * cutoff * (2 * k == length - 1 ? 1.0 : std::sin(2.0 * pi * cutoff * t) / (2.0 * pi * cutoff * t));
+        const double window = 0.42 - (0.5 * std::cos(2.0 * pi * k / (length - 1))) + (0.08 * std::cos(4.0 * pi * k / (length - 1)));
+        taps[(size_t)k] = sinc * window;
+        sum += taps[(size_t)k];
+    }
+
+    std::vector<float> normalised((size_t)length);
+    for (size_t k = 0; k < normalised.size(); ++k)
+        normalised[k] = (float)(taps[k] / sum);
+    return normalised;
+}
+
+
+//==============================================================================
+void PolyphaseDecimator::prepare(int decimationFactor)
+{
+    factor = juce::jmax(1, decimationFactor);
+    const int tapsPerPhase = PolyphaseFilter::tapsPerPhase;
+
+    std::vector<float> taps = PolyphaseFilter::designLowpass(factor);
+    branches.assign((size_t)(factor * tapsPerPhase), 0.f);
+    for (int p = 0; p < factor; ++p)
+    {
+        for (int i = 0; i < tapsPerPhase; ++i)
+            branches[(size_t)((p * tapsPerPhase) + i)] = taps[(size_t)(p + (i * factor))];
+    }
+
+    lineLength = tapsPerPhase + PolyphaseFilter::blockSize + 1;
+    lines.assign((size_t)(factor * lineLength), 0.f);
+    reset();
+}
+
+void PolyphaseDecimator::reset()
+{
+    std::fill(lines.begin(), lines.end(), 0.f);
+    phase = 0;
+}
+
+// Output j is the sum over branches p of branch p run over x[jL - p], (j - 1)L - p and so on. Samples arrive in
+// the order x[jL - (L - 1)], ..., x[jL - 1], x[jL], so output j is due as the sample for branch 0 comes in
+int PolyphaseDecimator::process(const float* input, int numSamples, float* output)
+{
+    const int tapsPerPhase = PolyphaseFilter::tapsPerPhase;
+    int numWritten = 0;
+
+    int i = 0;
+    while (i < numSamples)
+    {
+        // Split the input into the lines, output m of the block reads position tapsPerPhase + m of each
+        int numOutputs = 0;
+        for (; i < numSamples && numOutputs < PolyphaseFilter::blockSize; ++i)
+        {
+            const int branch = phase == 0 ? 0 : factor - phase;
+            lines[(size_t)((branch * lineLength) + tapsPerPhase + numOutputs)] = input[i];
+            if (phase == 0)
+                ++numOutputs;
+            phase = phase + 1 == factor ? 0 : phase + 1;
+        }
+
+        float* block = output + numWritten;
+        juce::FloatVectorOperations::clear(block, numOutputs);
+        for (int p = 0; p < factor; ++p)
+        {
+            const float* line = lines.data() + (p * lineLength);
+            const float* branch = branches.data() + (p * tapsPerPhase);
+            for (int t = 0; t < tapsPerPhase; ++t)
+                juce::FloatVectorOperations::addWithMultiply(block, line + tapsPerPhase - t, branch[t], numOutputs);
+        }
+        numWritten += numOutputs;
+
+        // Keep the history for the next block, and a sample already taken for its first output
+        if (numOutputs > 0)
+        {
+            for (int p = 0; p < factor; ++p)
+            {
+                float* line = lines.data() + (p * lineLength);
+                std::copy(line + numOutputs, line + numOutputs + tapsPerPhase + 1, line);
+            }
+        }
+    }
+    return numWritten;
+}
+
+
+//==============================================================================
+void PolyphaseInterpolator::prepare(int interpolationFactor)
+{
+    factor = juce::jmax(1, interpolationFactor);
+    const int tapsPerPhase = PolyphaseFilter::tapsPerPhase;
+
+    // Output phase p of input q is the sum over i of x[q - i] * h[p + i * factor]
+    std::vector<float> taps = PolyphaseFilter::designLowpass(factor);
+    branches.assign((size_t)(factor * tapsPerPhase), 0.f);
+    for (int p = 0; p < factor; ++p)
+    {
+        for (int i = 0; i < tapsPerPhase; ++i)
+            branches[(size_t)((p * tapsPerPhase) + i)] = (float)factor * taps[(size_t)(p + (i * factor))];
+    }
+
+    line.assign((size_t)(tapsPerPhase + PolyphaseFilter::blockSize), 0.f);
+    phaseOutput.assign((size_t)PolyphaseFilter::blockSize + 1, 0.f);
+    reset();
+}
+
+void PolyphaseInterpolator::reset()
+{
+    std::fill(line.begin(), line.end(), 0.f);
+    phase = 0;
+}
+
+int PolyphaseInterpolator::process(const float* input, int numSamples, float* output)
+{
+    const int tapsPerPhase = PolyphaseFilter::tapsPerPhase;
+    int numRead = 0;
+
+    int o = 0;
+    while (o < numSamples)
+    {
+        // As many outputs as a block of inputs covers. The outputs before the first phase 0 still use the newest input of the history
+        const int firstInput = (factor - phase) % factor;
+        const int numOutputs = juce::jmin(numSamples - o, firstInput + (PolyphaseFilter::blockSize * factor));
+        const int numInputs = getNumInputsFor(numOutputs);
+        std::copy(input + numRead, input + numRead + numInputs, line.begin() + tapsPerPhase);
+
+        for (int p = 0; p < factor; ++p)
+        {
+            const int first = (p - phase + factor) % factor;
+            if (first >= numOutputs)
+                continue;
+
+            // Output k reads the input at tapsPerPhase + r, r is -1 before the first input of the block
+            const int count = (numOutputs - first + factor - 1) / factor;
+            const int firstRead = first >= firstInput ? (first - firstInput) / factor : -1;
+
+            const float* branch = branches.data() + (p * tapsPerPhase);
+            juce::FloatVectorOperations::clear(phaseOutput.data(), count);
+            for (int t = 0; t < tapsPerPhase; ++t)
+                juce::FloatVectorOperations::addWithMultiply(phaseOutput.data(), line.data() + tapsPerPhase + firstRead - t, branch[t], count);
+
+            for (int k = 0; k < count; ++k)
+                output[o + first + (k * factor)] = phaseOutput[(size_t)k];
+        }
+
+        std::copy(line.begin() + numInputs, line.begin() + numInputs + tapsPerPhase, line.begin());
+        phase = (phase + numOutputs) % factor;
+        numRead += numInputs;
+        o += numOutputs;
+    }
+    return numRead;
+}
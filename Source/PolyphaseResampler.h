@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+
+    PolyphaseResampler.h
+    Created: 16 May 2022 9:27:44am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_dsp/juce_dsp.h>
+#include <vector>
+
+
+// The lowpass FIR shared by the decimator and interpolator of a whole factor. It has tapsPerPhase * factor
+// taps and stops at the Nyquist frequency of the lower rate. Each direction delays by (length - 1) / 2 samples
+// at the higher rate, so a decimator followed by an interpolator delays by length - 1. Tap p + i * factor
+// belongs to branch p, which only ever sees every factor-th sample
+namespace PolyphaseFilter
+{
+    constexpr int tapsPerPhase = 32;
+
+    // Samples at the lower rate filtered per pass
+    constexpr int blockSize = 64;
+
+    int getLength(int factor);
+    std::vector<float> designLowpass(int factor);
+}
+
+
+// Lowpass filters and keeps every factor-th sample, starting with the first one after a reset. The input is
+// split into one line per branch at the lower rate, and each branch is run over a block of outputs at once
+class PolyphaseDecimator
+{
+public:
+    void prepare(int decimationFactor);
+    void reset();
+
+    // Returns the number of samples written to output, at most numSamples / factor + 1
+    int process(const float* input, int numSamples, float* output);
+
+    int getFactor() const { return factor; }
+
+private:
+    int factor = 1;
+    int lineLength = 0;
+    int phase = 0;
+
+    // Branch p's taps from the newest sample back, and its line. A line holds tapsPerPhase samples of history, the
+    // block being filtered and the first sample of the output after it
+    std::vector<float> branches;
+    std::vector<float> lines;
+};
+
+
+// Raises the rate by a whole factor. Output phase p is the input filtered by branch p scaled by the factor, each
+// branch is run over a block of inputs at once and the phases are interleaved. Phases line up with a decimator
+// reset at the same time, so an input sample is taken wherever the decimator would have written one
+class PolyphaseInterpolator
+{
+public:
+    void prepare(int interpolationFactor);
+    void reset();
+
+    // Writes numSamples to output, returning the number of input samples read
+    int process(const float* input, int numSamples, float* output);
+
+    // The input samples the next numSamples outputs will read
+    int getNumInputsFor(int numSamples) const { return (numSamples + factor - 1 - ((factor - phase) % factor)) / factor; }
+
+    int getFactor() const { return factor; }
+
+private:
+    int factor = 1;
+    int phase = 0;
+
+    // tapsPerPhase inputs of history, the newest last, followed by the block being filtered
+    std::vector<float> branches;
+    std::vector<float> line;
+    std::vector<float> phaseOutput;
+};
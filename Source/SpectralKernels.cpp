@@ -0,0 +1,227 @@
+/*
+  ==============================================================================
+
+    SpectralKernels.cpp
+    Created: 4 Apr 2022 10:12:41am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#include "SpectralKernels.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #define SPECTRAL_KERNELS_SSE 1
+ #include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+ #define SPECTRAL_KERNELS_NEON 1
+ #include <arm_neon.h>
+#endif
+
+
+namespace SpectralKernels
+{
+
+void applyWindow(float* dest, const float* frame, const float* window, int numSamples)
+{
+    juce::FloatVectorOperations::multiply(dest, frame, window, numSamples);
+}
+
+void power(float* dest, const float* spectrum, int numBins)
+{
+    int k = 0;
+
+#if SPECTRAL_KERNELS_SSE
+    // Two loads hold four bins, the shuffles split them into real and imaginary lanes
+    for (; k + 4 <= numBins; k += 4)
+    {
+        __m128 a = _mm_loadu_ps(spectrum + (2 * k));
+        __m128 b = _mm_loadu_ps(spectrum + (2 * k) + 4);
+        __m128 re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(dest + k, _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+    }
+#elif SPECTRAL_KERNELS_NEON
+    for (; k + 4 <= numBins; k += 4)
+    {
+        float32x4x2_t bins = vld2q_f32(spectrum + (2 * k));
+        vst1q_f32(dest + k, vmlaq_f32(vmulq_f32(bins.val[0], bins.val[0]), bins.val[1], bins.val[1]));
+    }
+#endif
+
+    for (; k < numBins; ++k)
+    {
+        float re = spectrum[2 * k];
+        float im = spectrum[(2 * k) + 1];
+        dest[k] = (re * re) + (im * im);
+    }
+}
+
+void magnitude(float* dest, const float* spectrum, int numBins)
+{
+    power(dest, spectrum, numBins);
+
+    int k = 0;
+
+#if SPECTRAL_KERNELS_SSE
+    for (; k + 4 <= numBins; k += 4)
+        _mm_storeu_ps(dest + k, _mm_sqrt_ps(_mm_loadu_ps(dest + k)));
+#elif SPECTRAL_KERNELS_NEON
+    for (; k + 4 <= numBins; k += 4)
+        vst1q_f32(dest + k, vsqrtq_f32(vld1q_f32(dest + k)));
+#endif
+
+    for (; k < numBins; ++k)
+        dest[k] = std::sqrt(dest[k]);
+}
+
+float sum(const float* src, int start, int end)
+{
+    int i = start;
+    float total = 0;
+
+#if SPECTRAL_KERNELS_SSE
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4)
+        acc = _mm_add_ps(acc, _mm_loadu_ps(src + i));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif SPECTRAL_KERNELS_NEON
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= end; i += 4)
+        acc = vaddq_f32(acc, vld1q_f32(src + i));
+    total = vaddvq_f32(acc);
+#endif
+
+    for (; i < end; ++i)
+        total += src[i];
+    return total;
+}
+
+float weightedSum(const float* src, const float* weights, int start, int end)
+{
+    int i = start;
+    float total = 0;
+
+#if SPECTRAL_KERNELS_SSE
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= end; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + i), _mm_loadu_ps(weights + i)));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif SPECTRAL_KERNELS_NEON
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= end; i += 4)
+        acc = vmlaq_f32(acc, vld1q_f32(src + i), vld1q_f32(weights + i));
+    total = vaddvq_f32(acc);
+#endif
+
+    for (; i < end; ++i)
+        total += src[i] * weights[i];
+    return total;
+}
+
+
+// The domain is a template parameter so neither loop branches on it
+template <bool powerDomain>
+void subtractionGains(float* gains, float* subtracted, const float* noisy, const float* noise,
+                      float scale, float floor, int start, int end)
+{
+    int w = start;
+
+#if SPECTRAL_KERNELS_SSE
+    const __m128 scaleV = _mm_set1_ps(scale);
+    const __m128 floorV = _mm_set1_ps(floor);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    for (; w + 4 <= end; w += 4)
+    {
+        __m128 Y = _mm_loadu_ps(noisy + w);
+        __m128 D = _mm_loadu_ps(noise + w);
+        __m128 sub = _mm_mul_ps(scaleV, D);
+        _mm_storeu_ps(subtracted + w, sub);
+
+        __m128 S = _mm_max_ps(_mm_sub_ps(Y, sub), _mm_mul_ps(floorV, D));
+
+        // Divide silent bins by one and mask their gain to zero afterwards
+        __m128 audible = _mm_cmpgt_ps(Y, zero);
+        __m128 divisor = _mm_or_ps(_mm_and_ps(audible, Y), _mm_andnot_ps(audible, one));
+        __m128 gain = _mm_div_ps(S, divisor);
+        if (powerDomain)
+            gain = _mm_sqrt_ps(gain);
+        _mm_storeu_ps(gains + w, _mm_and_ps(audible, gain));
+    }
+#elif SPECTRAL_KERNELS_NEON
+    const float32x4_t zero = vdupq_n_f32(0);
+    const float32x4_t one = vdupq_n_f32(1.f);
+    for (; w + 4 <= end; w += 4)
+    {
+        float32x4_t Y = vld1q_f32(noisy + w);
+        float32x4_t D = vld1q_f32(noise + w);
+        float32x4_t sub = vmulq_n_f32(D, scale);
+        vst1q_f32(subtracted + w, sub);
+
+        float32x4_t S = vmaxq_f32(vsubq_f32(Y, sub), vmulq_n_f32(D, floor));
+
+        uint32x4_t audible = vcgtq_f32(Y, zero);
+        float32x4_t gain = vdivq_f32(S, vbslq_f32(audible, Y, one));
+        if (powerDomain)
+            gain = vsqrtq_f32(gain);
+        vst1q_f32(gains + w, vbslq_f32(audible, gain, zero));
+    }
+#endif
+
+    for (; w < end; ++w)
+    {
+        float Y = noisy[w];
+        float D = noise[w];
+        float sub = scale * D;
+        subtracted[w] = sub;
+
+        float S = std::max(Y - sub, floor * D);
+        float ratio = S / (Y > 0 ? Y : 1.f);
+        float gain = powerDomain ? std::sqrt(ratio) : ratio;
+        gains[w] = Y > 0 ? gain : 0.f;
+    }
+}
+
+template void subtractionGains<false>(float*, float*, const float*, const float*, float, float, int, int);
+template void subtractionGains<true>(float*, float*, const float*, const float*, float, float, int, int);
+
+void applyGains(float* spectrum, const float* gains, int numBins)
+{
+    int k = 0;
+
+#if SPECTRAL_KERNELS_SSE
+    // Each gain is duplicated so it scales both halves of its bin
+    for (; k + 4 <= numBins; k += 4)
+    {
+        __m128 g = _mm_loadu_ps(gains + k);
+        float* bins = spectrum + (2 * k);
+        _mm_storeu_ps(bins, _mm_mul_ps(_mm_loadu_ps(bins), _mm_unpacklo_ps(g, g)));
+        _mm_storeu_ps(bins + 4, _mm_mul_ps(_mm_loadu_ps(bins + 4), _mm_unpackhi_ps(g, g)));
+    }
+#elif SPECTRAL_KERNELS_NEON
+    for (; k + 4 <= numBins; k += 4)
+    {
+        float32x4_t g = vld1q_f32(gains + k);
+        float32x4x2_t bins = vld2q_f32(spectrum + (2 * k));
+        bins.val[0] = vmulq_f32(bins.val[0], g);
+        bins.val[1] = vmulq_f32(bins.val[1], g);
+        vst2q_f32(spectrum + (2 * k), bins);
+    }
+#endif
+
+    for (; k < numBins; ++k)
+    {
+        spectrum[2 * k] *= gains[k];
+        spectrum[(2 * k) + 1] *= gains[k];
+    }
+}
+
+}
@@ -0,0 +1,46 @@
+/*
+  ==============================================================================
+
+    SpectralKernels.h
+    Created: 4 Apr 2022 10:12:41am
+    Author:  Bennett
+
+  ==============================================================================
+*/
+
+#pragma once
+#include <juce_dsp/juce_dsp.h>
+
+
+// Vectorised loops over float spectra. Spectra are interleaved (real, imag) pairs as written by
+// the real-only FFT, frames are plain float arrays. Unaligned input is fine, aligned input is faster
+namespace SpectralKernels
+{
+    // Byte alignment used for spectrum storage, enough for AVX loads
+    constexpr int alignment = 32;
+
+    // dest[i] = frame[i] * window[i]
+    void applyWindow(float* dest, const float* frame, const float* window, int numSamples);
+
+    // dest[k] = |X_k|^2
+    void power(float* dest, const float* spectrum, int numBins);
+
+    // dest[k] = |X_k|
+    void magnitude(float* dest, const float* spectrum, int numBins);
+
+    // Sum of src[start, end)
+    float sum(const float* src, int start, int end);
+
+    // Sum of src[i] * weights[i] over [start, end)
+    float weightedSum(const float* src, const float* weights, int start, int end);
+
+    // Subtracts scale * noise from noisy over [start, end), floored at floor * noise. The amount
+    // subtracted is written to subtracted and the gain that maps each noisy bin onto its clean
+    // value is written to gains. Silent bins get a gain of zero. Instantiated for both domains
+    template <bool powerDomain>
+    void subtractionGains(float* gains, float* subtracted, const float* noisy, const float* noise,
+                          float scale, float floor, int start, int end);
+
+    // X_k *= gains[k]
+    void applyGains(float* spectrum, const float* gains, int numBins);
+}
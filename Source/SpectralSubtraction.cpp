@@ -10,148 +10,966 @@
 */
 
 #include "SpectralSubtraction.h"
+#include "MixedRadixFFT.h"
 #include <cmath>
-#include <complex>
 
 
 
-SpectralSubtraction::SpectralSubtraction(int fft_order) : bandWeights(8, 1.f)
+SpectralSubtraction::SpectralSubtraction(int fft_order)
 {
-    setFFTOrder(fft_order);
-    setWindowOverlap(0.5f);
+    std::unique_ptr<Config> initial(new Config());
+    initial->NFFT = 1 << fft_order;
+    requestedSize = initial->NFFT;
+    publishConfig(std::move(initial));
+}
+
+// Size every workspace up front so that processing never touches the allocator
+void FrameWorkspace::prepare(int fftSize, FFTBackend::Type fftType)
+{
+    int windowSize = fftSize;
+    int numBins = (windowSize / 2) + 1;
+
+    fft = FFTBackend::create(fftSize, fftType);
+    spectrum.setSize(windowSize);
+    magnitudes.assign((size_t)numBins, 0);
+    gains.assign((size_t)numBins, 0);
+    subtracted.assign((size_t)numBins, 0);
+    output.assign((size_t)windowSize, 0);
+    bandValues.assign(PerceptualBands::maxBands, 0);
+    bandGains.assign(PerceptualBands::maxBands, 0);
+    bandSubtracted.assign(PerceptualBands::maxBands, 0);
+}
+
+// Frames are counted the same way for every buffer, a buffer shorter than a window still makes one frame
+FrameView::FrameView(const float* buffer, int size, int windowLength, int hopLength)
+    : samples(buffer), numSamples(size), windowSize(windowLength), hopSize(hopLength)
+{
+    numFrames = size < windowLength ? 1 : 1 + ((size - windowLength) / hopLength);
+}
 
-    calculateFrequencyBands();
+// Allocate room for an fft of the given size, aligned for the vector kernels
+void Spectrum::setSize(int size)
+{
+    fftSize = size;
+    numBins = (size / 2) + 1;
+    storage.assign((size_t)(2 * size) + (SpectralKernels::alignment / sizeof(float)), 0.f);
+    bins = juce::snapPointerToAlignment(storage.data(), SpectralKernels::alignment);
+}
+
+// Copies re-align into their own storage
+Spectrum& Spectrum::operator=(const Spectrum& other)
+{
+    if (this != &other)
+    {
+        setSize(other.fftSize);
+        if (fftSize > 0)
+            std::copy(other.bins, other.bins + (2 * fftSize), bins);
+    }
+    return *this;
 }
 
+
 SpectralSubtraction::~SpectralSubtraction()
 {
-    if (fft) 
-        delete fft;
+    // A rebuild in progress finishes before the configurations are freed
+    rebuildPool.removeAllJobs(false, -1);
+}
+
+SpectralSubtraction::ProcessingState::ProcessingState(const Config& config)
+    : fftSize(config.windowSize), fftType(config.fftType), hopSize(config.hopSize), synthesisSize(config.synthesisSize),
+      decimationFactor(config.decimationFactor), preparedBlock(config.maxBlock)
+{
+    workspace.prepare(config.windowSize, config.fftType);
+    prepareBlocks(config, config.maxBlock);
+
+    // The input holds a window less one hop of history, and the output is primed with one hop of
+    // silence so it never runs dry. The output has room for a window being added on top of the priming
+    // hop and everything one push can produce
+    streamInput.setCapacity(config.windowSize);
+    streamInput.fill(0.f, config.windowSize - config.hopSize);
+    streamOutput.setCapacity(config.windowSize + std::max(config.maxBlock, config.windowSize) + (2 * config.hopSize));
+    streamOutput.fill(0.f, config.hopSize);
+    streamResets = config.streamResets;
+
+    // The delays have room for as much as the stream holds on top of their own length
+    if (decimationFactor > 1)
+    {
+        const int streamSlack = std::max(config.maxBlock, config.windowSize) + (2 * config.hopSize);
+        bandDecimator.prepare(decimationFactor);
+        bandInterpolator.prepare(decimationFactor);
+        lowerBandDelay.setCapacity(config.synthesisSize + streamSlack);
+        upperBandDelay.setCapacity(config.latencySamples + (decimationFactor * streamSlack));
+        bandSamples.assign((size_t)(std::max(config.maxBlock, config.windowSize * decimationFactor) / decimationFactor) + 1, 0.f);
+        delayedBandSamples.assign(bandSamples.size(), 0.f);
+        clearBands(config);
+    }
+}
+
+// Start the resampling over with the delays primed with silence, in step with a stream that was just cleared
+void SpectralSubtraction::ProcessingState::clearBands(const Config& config)
+{
+    bandDecimator.reset();
+    bandInterpolator.reset();
+    lowerBandDelay.reset();
+    lowerBandDelay.fill(0.f, config.synthesisSize);
+    upperBandDelay.reset();
+    upperBandDelay.fill(0.f, config.latencySamples);
+}
+
+// Size the buffers used by processBuffer and the stream for blocks of up to maxBlockSize samples
+void SpectralSubtraction::ProcessingState::prepareBlocks(const Config& config, int maxBlockSize)
+{
+    maxBlock = maxBlockSize;
+    int maxSamples = std::max(maxBlock, config.windowSize);
+    int maxFrames = 1 + ((maxSamples - config.windowSize) / config.hopSize);
+
+    blockSpectra.assign((size_t)maxFrames, Spectrum(config.windowSize));
+    blockCleanFrames.assign((size_t)maxFrames, Frame((size_t)config.windowSize, 0));
+    blockSamples.assign((size_t)maxSamples, 0.f);
+}
+
+// A state can be shared by any configuration with the same fft size, hop, rate and block size
+bool SpectralSubtraction::ProcessingState::matches(const Config& config) const
+{
+    return fftSize == config.windowSize && fftType == config.fftType && hopSize == config.hopSize && synthesisSize == config.synthesisSize
+        && decimationFactor == config.decimationFactor && preparedBlock == config.maxBlock;
+}
+
+SpectralSubtraction::EstimationState::EstimationState(const Config& config)
+    : numBins(config.numBins), decimationFactor(config.decimationFactor)
+{
+    const int numEstimates = config.getNumEstimates();
+    noiseEstimation.assign((size_t)config.noiseProfileFrames, Frame((size_t)numEstimates, 0));
+    noiseEstimationSum.assign((size_t)numEstimates, 0);
+    a_SNR.assign((size_t)numEstimates, 0);
+    estimationSmoothing.assign((size_t)numEstimates, 0);
+    estimationResets = config.estimationResets;
+
+    smoothedValues.assign((size_t)numEstimates, 0);
+    subWindowMinimum.assign((size_t)numEstimates, 0);
+    subWindowMinima.assign((size_t)minimumSubWindows, Frame((size_t)numEstimates, 0));
+    trackedMinimum.assign((size_t)numEstimates, 0);
+    speechPresence.assign((size_t)numEstimates, 0);
+    trackedNoise.assign((size_t)numEstimates, 0);
+}
+
+// A band estimate keeps its size across fft sizes, but its values still scale with the window
+bool SpectralSubtraction::EstimationState::matches(const Config& config) const
+{
+    return (int)noiseEstimation.size() == config.noiseProfileFrames && (int)noiseEstimationSum.size() == config.getNumEstimates()
+        && numBins == config.numBins && decimationFactor == config.decimationFactor;
+}
+
+
+
+
+// The newest configuration. The lock keeps the rebuild thread from adding one while it is read, and
+// configurations are only freed on the settings thread, so the reference stays valid there
+const SpectralSubtraction::Config& SpectralSubtraction::latestConfig() const
+{
+    const juce::ScopedLock lock(configLock);
+    return *configs.back();
+}
+
+// Pick up the newest configuration. Called once per block by the thread that processes. The configuration
+// is marked in use before checking it is still the newest, so the settings thread can never free it in between.
+// The one being handed over from stays marked until the handover is done
+const SpectralSubtraction::Config& SpectralSubtraction::acquireConfig(bool streaming)
+{
+    const Config* current = activeConfig;
+    const Config* previous = fadingConfig != nullptr ? fadingConfig : current;
+    fadingConfigInUse.store(previous);
+
+    // The current configuration may be retired once the newest is marked, only its buffers are compared
+    const ProcessingState* currentProcessing = current != nullptr ? current->processing.get() : nullptr;
+    const EstimationState* currentEstimation = current != nullptr ? current->estimation.get() : nullptr;
+
+    const Config* newest;
+    do
+    {
+        newest = publishedConfig.load();
+        configInUse.store(newest);
+    }
+    while (newest != publishedConfig.load());
+
+    activeConfig = newest;
+    // An adaptive estimate is carried over to a new fft size or rate, and a stream whose buffers were replaced fades across
+    if (current != nullptr && newest != current)
+    {
+        if (newest->estimation.get() != currentEstimation && (newest->numBins != previous->numBins || newest->decimationFactor != previous->decimationFactor))
+            projectEstimation(*previous, *newest);
+        if (streaming && newest->processing.get() != currentProcessing)
+            beginTransition(*previous, *newest);
+    }
+
+    // Carry out any resets the settings thread asked for. A reset stream starts over, so there is nothing to fade from
+    applyEstimationResets(*newest);
+    if (newest->processing->streamResets != newest->streamResets)
+    {
+        clearStream(*newest);
+        endTransition();
+    }
+
+    // Only a stream that is still fading out needs to stay marked
+    fadingConfigInUse.store(fadingConfig);
+    return *newest;
+}
+
+// Publish a new configuration. The settings thread also frees the older ones nothing is reading any more
+void SpectralSubtraction::publishConfig(std::unique_ptr<Config> next, bool releaseRetired)
+{
+    const juce::ScopedLock lock(configLock);
+    prepareConfig(*next, configs.empty() ? nullptr : configs.back().get());
+    configs.push_back(std::move(next));
+    publishedConfig.store(configs.back().get());
+
+    if (releaseRetired)
+        releaseRetiredConfigs();
+}
+
+// Free every configuration but the newest and the ones the processing thread has marked. The marks are read
+// in the opposite order to the one the processing thread moves them in, so a configuration is always in one
+void SpectralSubtraction::releaseRetiredConfigs()
+{
+    const juce::ScopedLock lock(configLock);
+    const Config* inUse = configInUse.load();
+    const Config* fading = fadingConfigInUse.load();
+    auto retired = std::remove_if(configs.begin(), configs.end() - 1, [inUse, fading](const std::unique_ptr<Config>& config)
+    {
+        return config.get() != inUse && config.get() != fading;
+    });
+    configs.erase(retired, configs.end() - 1);
+}
+
+// Work out everything that depends on the settings. Tables and buffers that are already the right size are
+// kept, so the stream and the adaptive estimate carry on through them, and a rebuilt size is only built once
+void SpectralSubtraction::prepareConfig(Config& next, const Config* previous)
+{
+    next.NFFT = MixedRadixFFT::nextSupportedSize(next.NFFT);
+
+    // A reduced rate keeps the window's length in time, and with it the spacing of the bins. Down to 8 kHz from 48 kHz
+    next.decimationFactor = next.processingRate > 0 ? juce::jlimit(1, 6, (int)(next.sampleRate / next.processingRate)) : 1;
+    next.windowSize = MixedRadixFFT::nextSupportedSize((next.NFFT + next.decimationFactor - 1) / next.decimationFactor);
+    next.fftType = FFTBackend::resolveType(next.windowSize, next.fftBackend);
+    next.numBins = (next.windowSize / 2) + 1;
+    if (next.lowLatencyEnabled)
+        next.hopSize = juce::jlimit(1, next.windowSize / 2, next.lowLatencyHopSize / next.decimationFactor);
+    else
+        next.hopSize = (int)((float)next.windowSize * (1.f - next.windowOverlap));
+    next.synthesisSize = next.lowLatencyEnabled ? 2 * next.hopSize : next.windowSize;
+    next.resamplingDelay = next.decimationFactor > 1 ? PolyphaseFilter::getLength(next.decimationFactor) - 1 : 0;
+    next.latencySamples = (next.synthesisSize * next.decimationFactor) + next.resamplingDelay;
+
+    // Create window functions
+    if (next.windows == nullptr || (int)next.windows->front().size() != next.windowSize)
+        createWindow(next);
+    if (previous == nullptr || (int)next.overlapScale.size() != next.windowSize || next.hopSize != previous->hopSize || next.windowType != previous->windowType
+        || next.lowLatencyEnabled != previous->lowLatencyEnabled)
+        calculateOverlapScale(next);
+
+    // A profile taken at another fft size or rate is moved onto the new bins. A noise bin's magnitude grows with the
+    // square root of both the window length and the rate
+    if (!next.averageNoise.empty() && ((int)next.averageNoise.size() != next.numBins || next.averageNoiseFactor != next.decimationFactor))
+    {
+        int previousBins = (int)next.averageNoise.size();
+        float rateRatio = (float)next.averageNoiseFactor / (float)next.decimationFactor;
+        float scale = std::sqrt(((float)next.windowSize * rateRatio) / (float)((previousBins - 1) * 2));
+        Frame projected((size_t)next.numBins, 0);
+        projectSpectrum(next.averageNoise, previousBins, projected, next.numBins, scale, rateRatio);
+        next.averageNoise = projected;
+    }
+    next.averageNoiseFactor = next.decimationFactor;
+
+    // Band ranges depend on the number of bins
+    if (previous == nullptr || next.numBins != previous->numBins || next.numFrequencyBands != previous->numFrequencyBands)
+        calculateFrequencyBands(next);
+    calculatePerceptualBands(next);
+    calculateMinimumTracking(next);
+    selectSubtractionKernel(next);
+
+    // Estimation ring and processing workspaces, only reallocated when their sizes change
+    if (next.processing == nullptr || !next.processing->matches(next))
+        next.processing = std::make_shared<ProcessingState>(next);
+    if (next.estimation == nullptr || !next.estimation->matches(next))
+        next.estimation = std::make_shared<EstimationState>(next);
+}
+
+// Change the fft size without holding up the settings thread. The windows, fft and buffers for the
+// new size are built on the rebuild thread, the current size keeps running until they are published
+void SpectralSubtraction::setFFTSize(int fftSize)
+{
+    requestedSize = MixedRadixFFT::nextSupportedSize(fftSize);
+    rebuildPool.addJob([this]
+    {
+        rebuildConfig();
+        return juce::ThreadPoolJob::jobHasFinished;
+    });
+}
+
+void SpectralSubtraction::selectFFTBackends(int firstOrder, int lastOrder)
+{
+    rebuildPool.addJob([this, firstOrder, lastOrder]
+    {
+        FFTBackend::selectFastestTypes(firstOrder, lastOrder);
+        rebuildConfig();
+        return juce::ThreadPoolJob::jobHasFinished;
+    });
+}
+
+// Runs on the rebuild thread. Everything that depends on the size or the fft engine is built without the
+// lock, then taken over by a copy of whatever settings are newest once it is done
+void SpectralSubtraction::rebuildConfig()
+{
+    const int size = requestedSize.load();
+
+    Config built;
+    {
+        const juce::ScopedLock lock(configLock);
+        const Config& latest = latestConfig();
+        if (latest.NFFT == size && FFTBackend::resolveType(latest.windowSize, latest.fftBackend) == latest.fftType)
+            return;
+        built = latest;
+    }
+    built.NFFT = size;
+    prepareConfig(built, nullptr);
+
+    const juce::ScopedLock lock(configLock);
+
+    // A later request has its own job queued behind this one
+    if (requestedSize.load() != size)
+        return;
+
+    std::unique_ptr<Config> next(new Config(latestConfig()));
+    next->NFFT = size;
+    next->windows = built.windows;
+    next->perceptualBands = built.perceptualBands;
+    next->processing = built.processing;
+    next->estimation = built.estimation;
+
+    // Configurations can only be freed on the settings thread
+    publishConfig(std::move(next), false);
+}
+
+
+// Start fading from the stream that is playing to the new one. If a fade is already under way the stream
+// it was fading out keeps playing, and the new one starts priming again
+void SpectralSubtraction::beginTransition(const Config& previous, const Config& next)
+{
+    fadingConfig = &previous;
+
+    // The new stream starts from silence, it has a full window of input behind its output after two windows and the resampling
+    transitionPosition = 0;
+    transitionPrimeSamples = (2 * next.windowSize * next.decimationFactor) + next.resamplingDelay;
+    transitionFadeSamples = juce::jmax(1, next.hopSize * next.decimationFactor);
+}
+
+// Interpolate each frame of an adaptive estimate onto another fft size or rate. The new ring was allocated
+// by the settings thread, so this only reads and writes frames
+void SpectralSubtraction::projectEstimation(const Config& from, const Config& to)
+{
+    const EstimationState& source = *from.estimation;
+    EstimationState& destination = *to.estimation;
+    const bool projectRing = source.noiseEstimationCount > 0 && destination.noiseEstimationCount == 0;
+    const bool projectTracking = source.trackingStarted && !destination.trackingStarted;
+    if (!projectRing && !projectTracking)
+        return;
+
+    // Bands stay at the same frequencies across fft sizes, but not across rates or band counts. Those start over
+    const bool bands = from.perceptualBands != nullptr || to.perceptualBands != nullptr;
+    if (bands && (from.perceptualBands == nullptr || to.perceptualBands == nullptr || from.getNumEstimates() != to.getNumEstimates()
+                  || from.decimationFactor != to.decimationFactor))
+        return;
+
+    // A noise bin's power grows with the window length and the rate
+    float rateRatio = (float)from.decimationFactor / (float)to.decimationFactor;
+    float powerScale = ((float)to.windowSize * rateRatio) / (float)from.windowSize;
+    float scale = from.subtractionDomain == 1 ? std::sqrt(powerScale) : powerScale;
+
+    const int sourceEstimates = from.getNumEstimates();
+    const int destinationEstimates = to.getNumEstimates();
+    if (projectRing)
+    {
+        // The newest frames are kept, oldest first
+        int sourceCapacity = (int)source.noiseEstimation.size();
+        int count = juce::jmin(source.noiseEstimationCount, (int)destination.noiseEstimation.size());
+        int first = source.noiseEstimationStart + source.noiseEstimationCount - count;
+        for (int i = 0; i < count; ++i)
+            projectSpectrum(source.noiseEstimation[(size_t)((first + i) % sourceCapacity)], sourceEstimates, destination.noiseEstimation[(size_t)i], destinationEstimates, scale, rateRatio);
+
+        destination.noiseEstimationStart = 0;
+        destination.noiseEstimationCount = count;
+        resumNoiseEstimation(destination, destinationEstimates);
+    }
+
+    // Minimum tracking carries on from the same point in its sub-window, the chance of speech is not scaled
+    if (projectTracking)
+    {
+        projectSpectrum(source.smoothedValues, sourceEstimates, destination.smoothedValues, destinationEstimates, scale, rateRatio);
+        projectSpectrum(source.subWindowMinimum, sourceEstimates, destination.subWindowMinimum, destinationEstimates, scale, rateRatio);
+        for (int u = 0; u < EstimationState::minimumSubWindows; ++u)
+            projectSpectrum(source.subWindowMinima[(size_t)u], sourceEstimates, destination.subWindowMinima[(size_t)u], destinationEstimates, scale, rateRatio);
+        projectSpectrum(source.trackedMinimum, sourceEstimates, destination.trackedMinimum, destinationEstimates, scale, rateRatio);
+        projectSpectrum(source.trackedNoise, sourceEstimates, destination.trackedNoise, destinationEstimates, scale, rateRatio);
+        projectSpectrum(source.speechPresence, sourceEstimates, destination.speechPresence, destinationEstimates, 1, rateRatio);
+
+        destination.subWindowPosition = source.subWindowPosition;
+        destination.subWindowIndex = source.subWindowIndex;
+        destination.trackingStarted = true;
+    }
 }
 
+// Linearly interpolate a half spectrum onto a different number of bins. The destination's rate is rateRatio times the
+// source's, frequencies above the source's highest bin take its value
+void SpectralSubtraction::projectSpectrum(const Frame& source, int sourceBins, Frame& destination, int destinationBins, float scale, float rateRatio)
+{
+    const float step = rateRatio * (float)(sourceBins - 1) / (float)juce::jmax(1, destinationBins - 1);
+    for (int k = 0; k < destinationBins; ++k)
+    {
+        float position = juce::jmin((float)k * step, (float)(sourceBins - 1));
+        int lower = juce::jmin((int)position, sourceBins - 1);
+        int upper = juce::jmin(lower + 1, sourceBins - 1);
+        float fraction = position - (float)lower;
+        destination[(size_t)k] = scale * (source[(size_t)lower] + (fraction * (source[(size_t)upper] - source[(size_t)lower])));
+    }
+}
 
+void SpectralSubtraction::endTransition()
+{
+    fadingConfig = nullptr;
+    fadingConfigInUse.store(nullptr);
+}
 
 
+// Prepare for processing blocks of up to maxBlockSize samples at the given fft size
+void SpectralSubtraction::prepareFFTSize(int maxBlockSize, int fftSize)
+{
+    // Built straight away, a rebuild still queued for another size gives up when it sees this
+    const int size = MixedRadixFFT::nextSupportedSize(fftSize);
+    requestedSize = size;
+    updateConfig([=](Config& c)
+    {
+        c.maxBlock = maxBlockSize;
+        c.NFFT = size;
+    });
+}
+
 // Process a buffer in place
 void SpectralSubtraction::processBuffer(float* buffer, int size)
 {
-    // Enframe buffer into overlapping frames
-    Matrix frames = createSignalFrames(buffer, size, windowSize, hopSize);
+    const Config& config = acquireConfig();
+    ProcessingState& state = *config.processing;
+
+    // Only grows if the caller never prepared for a block this large
+    if (size > state.maxBlock)
+        state.prepareBlocks(config, size);
 
-    // Transform into frequency domain
-    SpectrumMatrix freqData = createFrequencyData(frames);
+    // Transform each overlapping frame into the frequency domain, reading straight from the buffer
+    int numFrames = createFrequencyData(config, FrameView(buffer, size, config.windowSize, config.hopSize), state.blockSpectra);
 
-    if (subtractionEnabled)
+    if (config.subtractionEnabled)
     {
         // Subtract noise and inverse transform into time domain
-        Matrix cleanFrames = processSubtraction(freqData);
+        int numCleanFrames = subtractFrames(config, state.blockSpectra, numFrames, state.blockCleanFrames);
+        if (numCleanFrames == 0)
+            return;
 
         // Overlap and add samples to reconstruct signal
-        std::vector<float> cleanSignal = createSamplesFromFrames(cleanFrames, windowSize, hopSize);
+        int numSamples = createSamplesFromFrames(config, state.blockCleanFrames, numCleanFrames, config.windowSize, config.hopSize, state.blockSamples);
 
         // Copy into buffer
-        for (int i = 0; i < size; ++i)
-        {
-            buffer[i] = cleanSignal[i];
-        }
-        //std::memcpy(buffer, &cleanSignal[0], size);
+        std::copy(state.blockSamples.begin(), state.blockSamples.begin() + std::min(size, numSamples), buffer);
     }
     
 
 }
 
 
-// Process spectral subtraction
-Matrix SpectralSubtraction::processSubtraction(const std::vector<Spectrum>& frequencyData)
+// Process spectral subtraction, returning the number of frames written to output
+int SpectralSubtraction::processSubtraction(const SpectrumMatrix& frequencyData, int numFrames, Matrix& output)
 {
-    int numFrames = frequencyData.size();
-    Matrix output(numFrames);
+    return subtractFrames(acquireConfig(), frequencyData, numFrames, output);
+}
 
+int SpectralSubtraction::subtractFrames(const Config& config, const SpectrumMatrix& frequencyData, int numFrames, Matrix& output)
+{
     // Return if no noise estimate is available
-    const Frame* noiseEst = getNoiseEstimation();
+    const Frame* noiseEst = getNoiseEstimation(config);
     if (!noiseEst)
-        return Matrix();
+        return 0;
 
     // Loop through each frame
     for (int i = 0; i < numFrames; ++i)
     {
-        const Spectrum& dirtyFrame = frequencyData[i];
-        Spectrum cleanFrame(windowSize);
+        subtractFrame(config, frequencyData[(size_t)i], *noiseEst, output[(size_t)i], config.processing->workspace);
+    }
+
+    return numFrames;
+}
 
-        // Process subtraction separetely in each frequency band
-        for (int n = 0; n < numFrequencyBands; ++n)
+// Render a whole buffer offline into output. At a reduced rate the band is rendered on its own and the
+// upper band added back, the resampling delay is run off the end of the input so the output lines up
+void SpectralSubtraction::renderBuffer(const float* input, float* output, int numSamples, juce::ThreadPool* pool)
+{
+    // Runs on the settings thread, so the newest configuration can't be freed while it renders. An adaptive estimate
+    // starts from a cleared state of its own, so a render neither reads nor moves on the one the stream is using
+    Config config(latestConfig());
+    if (config.isEstimating())
+        config.estimation = std::make_shared<EstimationState>(config);
+    const int factor = config.decimationFactor;
+    if (factor == 1)
+    {
+        renderSamples(config, input, output, numSamples, pool);
+        return;
+    }
+
+    std::vector<float> padded((size_t)(numSamples + config.resamplingDelay), 0.f);
+    std::copy(input, input + numSamples, padded.begin());
+
+    PolyphaseDecimator decimator;
+    decimator.prepare(factor);
+    std::vector<float> band((padded.size() / (size_t)factor) + 1);
+    band.resize((size_t)decimator.process(padded.data(), (int)padded.size(), band.data()));
+
+    std::vector<float> cleanBand(band.size());
+    renderSamples(config, band.data(), cleanBand.data(), (int)band.size(), pool);
+
+    // The band is taken out of the input as far as the upper band gain puts it back
+    juce::FloatVectorOperations::addWithMultiply(cleanBand.data(), band.data(), -config.upperBandGain, (int)band.size());
+
+    PolyphaseInterpolator interpolator;
+    interpolator.prepare(factor);
+    std::vector<float> interpolated(padded.size());
+    interpolator.process(cleanBand.data(), (int)padded.size(), interpolated.data());
+
+    juce::FloatVectorOperations::copy(output, interpolated.data() + config.resamplingDelay, numSamples);
+    juce::FloatVectorOperations::addWithMultiply(output, padded.data(), config.upperBandGain, numSamples);
+}
+
+// Render samples at the processing rate. With a fixed noise estimate every frame is independent, so ranges
+// of frames are claimed by the pool's threads and their overlap-add seams are summed in order. Without a
+// pool every range is rendered on the calling thread
+void SpectralSubtraction::renderSamples(const Config& config, const float* input, float* output, int numSamples, juce::ThreadPool* pool)
+{
+    // Samples not covered by a full frame are left as they were, as in processBuffer
+    std::copy(input, input + numSamples, output);
+
+    const int windowSize = config.windowSize;
+    const int hopSize = config.hopSize;
+
+    const bool estimating = config.isEstimating();
+    if (!config.subtractionEnabled || (!estimating && getNoiseEstimation(config) == nullptr))
+        return;
+
+    FrameView frames(input, numSamples, windowSize, hopSize);
+    int numFrames = frames.getNumFrames();
+
+    // An adaptive estimate depends on every earlier frame, so it renders as one range on this thread
+    int framesPerChunk = estimating ? numFrames : renderChunkFrames;
+    int numChunks = (numFrames + framesPerChunk - 1) / framesPerChunk;
+    int numJobs = (estimating || pool == nullptr) ? 1 : juce::jlimit(1, numChunks, pool->getNumThreads());
+
+    // Each range overlap-adds into its own buffer so no two threads write the same samples
+    std::vector<std::vector<float>> chunkOutputs((size_t)numChunks);
+    for (int c = 0; c < numChunks; ++c)
+    {
+        int chunkFrames = juce::jmin(framesPerChunk, numFrames - (c * framesPerChunk));
+        chunkOutputs[(size_t)c].assign((size_t)(((chunkFrames - 1) * hopSize) + windowSize), 0.f);
+    }
+
+    std::vector<FrameWorkspace> workspaces((size_t)numJobs);
+    for (FrameWorkspace& workspace : workspaces)
+        workspace.prepare(config.windowSize, config.fftType);
+
+    // Threads claim the next unrendered range until none are left
+    std::atomic<int> nextChunk { 0 };
+    auto renderChunks = [&](FrameWorkspace& workspace)
+    {
+        for (int c = nextChunk++; c < numChunks; c = nextChunk++)
         {
-            // This check prevents issues when band slider is changed while processing
-            if (n >= frequencyBandRanges.size()) 
-                break;
-
-            // Calculate oversubtraction determined from frame SNR
-            const std::pair<int, int>& range = frequencyBandRanges[n];
-            double snr = segmentalSNR(dirtyFrame, *noiseEst, range);
-            double overSubtraction = calculateOverSubtraction(snr);
-            const double& bandWeight = bandWeights[n];
-
-            // Loop through each frequency index
-            for (int w = range.first; w < range.second; ++w)
+            int firstFrame = c * framesPerChunk;
+            int lastFrame = juce::jmin(firstFrame + framesPerChunk, numFrames);
+            renderFrames(config, frames, firstFrame, lastFrame, chunkOutputs[(size_t)c].data(), workspace);
+        }
+    };
+
+    if (numJobs == 1)
+    {
+        renderChunks(workspaces[0]);
+    }
+    else
+    {
+        std::atomic<int> jobsRemaining { numJobs };
+        juce::WaitableEvent finished;
+        for (int j = 0; j < numJobs; ++j)
+        {
+            pool->addJob([&, j]
             {
-                // Get magnitude and phase of input signal
-                double currMag = dirtyFrame[w].magnitude();
-                double phase = dirtyFrame[w].phase();
+                renderChunks(workspaces[(size_t)j]);
+                if (--jobsRemaining == 0)
+                    finished.signal();
+                return juce::ThreadPoolJob::jobHasFinished;
+            });
+        }
+        finished.wait();
+    }
+
+    // Stitch the ranges back together in order, so the sum at every seam is the same on every run
+    int numRendered = juce::jmin(numSamples, ((numFrames - 1) * hopSize) + windowSize);
+    juce::FloatVectorOperations::clear(output, numRendered);
+    for (int c = 0; c < numChunks; ++c)
+    {
+        int start = c * framesPerChunk * hopSize;
+        int length = juce::jmin((int)chunkOutputs[(size_t)c].size(), numRendered - start);
+        juce::FloatVectorOperations::add(output + start, chunkOutputs[(size_t)c].data(), length);
+    }
+}
+
+// Process frames [firstFrame, lastFrame) and overlap-add them into output, which starts at the first frame
+void SpectralSubtraction::renderFrames(const Config& config, const FrameView& frames, int firstFrame, int lastFrame, float* output, FrameWorkspace& workspace)
+{
+    for (int i = firstFrame; i < lastFrame; ++i)
+    {
+        processFrame(config, frames.getRegions(i), workspace);
+        overlapAddFrame(config, workspace.output, output + ((i - firstFrame) * config.hopSize));
+    }
+}
+
+// Subtract the noise estimate from a single frame and transform it back to the time domain
+void SpectralSubtraction::subtractFrame(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, Frame& output, FrameWorkspace& workspace)
+{
+    // Gains for every bin from the kernel selected for the current settings
+    (this->*config.subtractionKernel)(config, dirtyFrame, noiseEst, workspace);
+
+    // The gains are applied in place, so frames that are not already in the workspace are copied in
+    Spectrum& cleanFrame = workspace.spectrum;
+    if (&dirtyFrame != &cleanFrame)
+        juce::FloatVectorOperations::copy(cleanFrame.data(), dirtyFrame.data(), 2 * config.numBins);
+
+    // Scaling each noisy bin by its gain keeps the phase without any trig
+    SpectralKernels::applyGains(cleanFrame.data(), &workspace.gains[0], config.numBins);
+
+    // Transform output back to time domain
+    calculateIFFT(cleanFrame, output, workspace);
+}
+
+
+// Calculate the gain of every bin of a frame. The domain and band count are template parameters so
+// none of the per bin loops branch on them
+template <bool powerDomain, bool multiBand>
+void SpectralSubtraction::calculateGains(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, FrameWorkspace& workspace)
+{
+    // Magnitude or power of every bin, computed once and shared by the band SNR and the gains
+    Frame& noisySpectrum = workspace.magnitudes;
+    if (powerDomain)
+        complexToPowerSpectrum(dirtyFrame, noisySpectrum);
+    else
+        complexToMagnitudeSpectrum(dirtyFrame, noisySpectrum);
 
-                // Magnitude or power spectrum
-                double Y_w = subtractionDomain == 1 ? currMag : (currMag * currMag);
+    // A single band covers every bin
+    int numBands = multiBand ? juce::jmin(config.numFrequencyBands, (int)config.frequencyBandRanges.size()) : 1;
 
-                // Get noise estimate 
-                double D_w = (*noiseEst)[w];
+    // Process subtraction separetely in each frequency band
+    for (int n = 0; n < numBands; ++n)
+    {
+        // Calculate oversubtraction determined from frame SNR
+        const std::pair<int, int> range = multiBand ? config.frequencyBandRanges[(size_t)n] : std::pair<int, int>(0, config.numBins);
+        double snr = segmentalSNR(noisySpectrum, noiseEst, range);
+        double overSubtraction = calculateOverSubtraction(config, snr);
+        const double& bandWeight = config.bandWeights[(size_t)n];
+
+        // Subtract the weighted estimate from each bin and turn the result into a real gain.
+        // Flooring smoothes out the valleys to reduce distortion
+        SpectralKernels::subtractionGains<powerDomain>(&workspace.gains[0], &workspace.subtracted[0], &noisySpectrum[0], &noiseEst[0],
+                                                       (float)(overSubtraction * bandWeight), (float)config.subtractionFloor,
+                                                       range.first, range.second);
+    }
+}
+
+// Calculate the gains on perceptual bands. The noise estimate is per band, each band sets its over subtraction
+// from its own SNR, and only the band gains are interpolated back to the bins. What was subtracted stays per band
+template <bool powerDomain>
+void SpectralSubtraction::calculateBandGains(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, FrameWorkspace& workspace)
+{
+    const PerceptualBands& bands = *config.perceptualBands;
+    const int numBands = bands.getNumBands();
+
+    Frame& noisySpectrum = workspace.magnitudes;
+    if (powerDomain)
+        complexToPowerSpectrum(dirtyFrame, noisySpectrum);
+    else
+        complexToMagnitudeSpectrum(dirtyFrame, noisySpectrum);
+    bands.binsToBands(&noisySpectrum[0], &workspace.bandValues[0]);
+
+    for (int b = 0; b < numBands; ++b)
+    {
+        double snr = 10.0 * std::log10(workspace.bandValues[(size_t)b] / noiseEst[(size_t)b]);
+        double overSubtraction = calculateOverSubtraction(config, snr) * config.perceptualBandWeights[(size_t)b];
+        SpectralKernels::subtractionGains<powerDomain>(&workspace.bandGains[0], &workspace.bandSubtracted[0], &workspace.bandValues[0], &noiseEst[0],
+                                                       (float)overSubtraction, (float)config.subtractionFloor, b, b + 1);
+    }
+
+    bands.bandsToBins(&workspace.bandGains[0], &workspace.gains[0]);
+}
 
-                // How much magnitude should be subtracted
-                double magSubtracted = (overSubtraction * bandWeight * D_w);
-                noiseSubtracted[w] = magSubtracted;
+// Pick the gain kernel for the domain and number of bands
+void SpectralSubtraction::selectSubtractionKernel(Config& config)
+{
+    const bool multiBand = config.numFrequencyBands > 1;
+    if (config.perceptualBands != nullptr)
+        config.subtractionKernel = config.subtractionDomain == 1 ? &SpectralSubtraction::calculateBandGains<false> : &SpectralSubtraction::calculateBandGains<true>;
+    else if (config.subtractionDomain == 1)
+        config.subtractionKernel = multiBand ? &SpectralSubtraction::calculateGains<false, true> : &SpectralSubtraction::calculateGains<false, false>;
+    else
+        config.subtractionKernel = multiBand ? &SpectralSubtraction::calculateGains<true, true> : &SpectralSubtraction::calculateGains<true, false>;
+}
 
-                // Apply subtraction. Flooring smoothes out the valleys to reduce distortion
-                double S_w = std::max(Y_w - magSubtracted, subtractionFloor * D_w);
-                
-                // Handle magnitude/power spectrum
-                double mag = subtractionDomain == 1 ? S_w : std::sqrt(S_w);
 
-                // Convert to complex number and add to clean signal
-                double real = mag * std::cos(phase);
-                double imag = mag * std::sin(phase);
-                cleanFrame[w] = Complex(real, imag);
+// Run a single frame through analysis, estimation and subtraction into workspace.output
+void SpectralSubtraction::processFrame(const Config& config, const FrameRegions& frame, FrameWorkspace& workspace)
+{
+    const bool estimating = config.isEstimating();
+
+    if (config.subtractionEnabled || estimating)
+    {
+        frequencySpectrum(config, frame, workspace.spectrum, workspace);
+        updateAdaptiveEstimate(config, workspace.spectrum, workspace);
 
-            }
+        const Frame* noiseEst = getNoiseEstimation(config);
+        if (config.subtractionEnabled && noiseEst)
+        {
+            subtractFrame(config, workspace.spectrum, *noiseEst, workspace.output, workspace);
+            return;
         }
-        
-        // Transform output back to time domain
-        output[i] = calculateIFFT(cleanFrame);
     }
 
-    return output;
+    // Unprocessed frames still carry the analysis window so the overlap-add gain matches
+    windowFrame(config, frame, &workspace.output[0]);
 }
 
 
 
 
 
-// Change the fft order for processing
-void SpectralSubtraction::setFFTOrder(int fft_order) 
+// Clear the streaming state. The input keeps a window less one hop of silent history, and the output is
+// primed with one hop of silence so it never runs dry
+void SpectralSubtraction::clearStream(const Config& config)
 {
-    order = fft_order;
-    NFFT = 1 << order;
-    windowSize = NFFT;
-    hopSize = windowSize* (1.f - windowOverlap);
+    ProcessingState& state = *config.processing;
+    state.streamInput.reset();
+    state.streamInput.fill(0.f, config.windowSize - config.hopSize);
+
+    // Partial sums are left in the output's free space, so all of it is cleared
+    state.streamOutput.reset();
+    CircularBuffer<float>::Regions<float*> output = state.streamOutput.prepareToWrite(state.streamOutput.getCapacity());
+    juce::FloatVectorOperations::clear(output.first, output.firstSize);
+    juce::FloatVectorOperations::clear(output.second, output.secondSize);
+    state.streamOutput.fill(0.f, config.hopSize);
+    state.streamResets = config.streamResets;
+
+    if (config.decimationFactor > 1)
+        state.clearBands(config);
+}
 
-    if (fft) delete fft;
-    fft = new juce::dsp::FFT(order);
+// Add input samples to the stream, processing a frame every time a hop of new samples is complete.
+// While a stream is fading out it is fed the same samples
+void SpectralSubtraction::pushSamples(const float* samples, int numSamples)
+{
+    const Config& config = acquireConfig(true);
+    streamSamples(config, samples, numSamples);
+    if (fadingConfig != nullptr)
+        streamSamples(*fadingConfig, samples, numSamples);
+}
 
-    // Resize noise estimate buffers
-    a_SNR.resize(windowSize);
-    noiseSubtracted.resize(windowSize);
-    estimationSmoothing.resize(windowSize);
+// At a reduced rate the input is decimated into the stream, and both delays are fed. A delay that is not being
+// read drops its oldest samples, as the stream's output does
+void SpectralSubtraction::streamSamples(const Config& config, const float* samples, int numSamples)
+{
+    const int factor = config.decimationFactor;
+    if (factor == 1)
+    {
+        writeStream(config, samples, numSamples);
+        return;
+    }
 
-    // Create window functions
-    createWindow();
+    ProcessingState& state = *config.processing;
+    auto delay = [](CircularBuffer<float>& buffer, const float* delayed, int numDelayed)
+    {
+        if (buffer.getFreeSpace() < numDelayed)
+            buffer.discard(numDelayed - buffer.getFreeSpace());
+        buffer.write(delayed, numDelayed);
+    };
 
+    const int chunkSize = ((int)state.bandSamples.size() - 1) * factor;
+    for (int offset = 0; offset < numSamples; offset += chunkSize)
+    {
+        int samplesThisTime = juce::jmin(chunkSize, numSamples - offset);
+        int numBand = state.bandDecimator.process(samples + offset, samplesThisTime, &state.bandSamples[0]);
+
+        writeStream(config, &state.bandSamples[0], numBand);
+        delay(state.lowerBandDelay, &state.bandSamples[0], numBand);
+        delay(state.upperBandDelay, samples + offset, samplesThisTime);
+    }
+}
+
+void SpectralSubtraction::writeStream(const Config& config, const float* samples, int numSamples)
+{
+    CircularBuffer<float>& input = config.processing->streamInput;
+
+    // Each sample is written once, whatever the overlap. A frame is due whenever the history holds a full window,
+    // the ring may have room for more when the window is not a power of two
+    int i = 0;
+    while (i < numSamples)
+    {
+        i += input.write(samples + i, juce::jmin(numSamples - i, config.windowSize - input.getNumReady()));
+
+        if (input.getNumReady() == config.windowSize)
+            processStreamFrame(config);
+    }
+}
+
+// Copy processed samples out of the stream, filling with silence if not enough are available. Reads from
+// the configuration the last push picked up, so a block's input and output use the same stream
+int SpectralSubtraction::pullSamples(float* samples, int numSamples)
+{
+    const Config& config = activeConfig != nullptr ? *activeConfig : acquireConfig(true);
+    int available = pullStream(config, samples, numSamples);
+    underrunSamples += numSamples - available;
+    if (fadingConfig != nullptr)
+        crossfadeStreams(samples, numSamples);
+    return available;
+}
+
+// Copy the same processed samples into every channel of buffer, straight from the output ring
+int SpectralSubtraction::pullSamples(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    const Config& config = activeConfig != nullptr ? *activeConfig : acquireConfig(true);
+    const int numChannels = buffer.getNumChannels();
+
+    // While a fade is under way, or the stream runs at a reduced rate, the output is put together in the block buffer first
+    if (fadingConfig != nullptr || config.decimationFactor > 1)
+    {
+        std::vector<float>& mixed = config.processing->blockSamples;
+        int available = 0;
+        for (int offset = 0; offset < numSamples; offset += (int)mixed.size())
+        {
+            int samplesThisTime = juce::jmin((int)mixed.size(), numSamples - offset);
+            available += pullSamples(&mixed[0], samplesThisTime);
+            for (int channel = 0; channel < numChannels; ++channel)
+                juce::FloatVectorOperations::copy(buffer.getWritePointer(channel, startSample + offset), &mixed[0], samplesThisTime);
+        }
+        return available;
+    }
+
+    CircularBuffer<float>& output = config.processing->streamOutput;
+    CircularBuffer<float>::Regions<const float*> ready = output.prepareToRead(numSamples);
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        float* destination = buffer.getWritePointer(channel, startSample);
+        juce::FloatVectorOperations::copy(destination, ready.first, ready.firstSize);
+        juce::FloatVectorOperations::copy(destination + ready.firstSize, ready.second, ready.secondSize);
+        juce::FloatVectorOperations::clear(destination + ready.size(), numSamples - ready.size());
+    }
+    output.finishedRead(ready.size());
+
+    underrunSamples += numSamples - ready.size();
+    return ready.size();
+}
+
+// Read finished output at the device rate. At a reduced rate the processed band replaces the band of the delayed
+// input, and what the upper band gain keeps of the rest is added back
+int SpectralSubtraction::pullStream(const Config& config, float* samples, int numSamples)
+{
+    const int factor = config.decimationFactor;
+    if (factor == 1)
+        return readStream(config, samples, numSamples);
+
+    ProcessingState& state = *config.processing;
+    float* band = &state.bandSamples[0];
+    float* delayedBand = &state.delayedBandSamples[0];
+    const float upperBandGain = config.upperBandGain;
+
+    int available = 0;
+    const int chunkSize = ((int)state.bandSamples.size() - 1) * factor;
+    for (int offset = 0; offset < numSamples; offset += chunkSize)
+    {
+        int samplesThisTime = juce::jmin(chunkSize, numSamples - offset);
+        int numBand = state.bandInterpolator.getNumInputsFor(samplesThisTime);
+        int numReady = readStream(config, band, numBand);
+
+        int numDelayed = state.lowerBandDelay.read(delayedBand, numBand);
+        juce::FloatVectorOperations::clear(delayedBand + numDelayed, numBand - numDelayed);
+        juce::FloatVectorOperations::addWithMultiply(band, delayedBand, -upperBandGain, numBand);
+
+        float* destination = samples + offset;
+        state.bandInterpolator.process(band, samplesThisTime, destination);
+
+        CircularBuffer<float>::Regions<const float*> upper = state.upperBandDelay.prepareToRead(samplesThisTime);
+        juce::FloatVectorOperations::addWithMultiply(destination, upper.first, upperBandGain, upper.firstSize);
+        juce::FloatVectorOperations::addWithMultiply(destination + upper.firstSize, upper.second, upperBandGain, upper.secondSize);
+        state.upperBandDelay.finishedRead(upper.size());
+
+        available += numReady == numBand ? samplesThisTime : juce::jmin(samplesThisTime, numReady * factor);
+    }
+    return available;
+}
+
+// Read finished output at the processing rate, filling with silence past what is ready
+int SpectralSubtraction::readStream(const Config& config, float* samples, int numSamples)
+{
+    int available = config.processing->streamOutput.read(samples, numSamples);
+    juce::FloatVectorOperations::clear(samples + available, numSamples - available);
+    return available;
+}
+
+// Mix the fading stream under the new one in samples. The fading stream plays alone until the new one
+// is primed, then fades out linearly over one hop of the new size
+void SpectralSubtraction::crossfadeStreams(float* samples, int numSamples)
+{
+    // The fading stream's block buffer is free while it only streams
+    std::vector<float>& fadingSamples = fadingConfig->processing->blockSamples;
+    const int chunkSize = (int)fadingSamples.size();
+
+    for (int offset = 0; offset < numSamples; offset += chunkSize)
+    {
+        int samplesThisTime = juce::jmin(chunkSize, numSamples - offset);
+        pullStream(*fadingConfig, &fadingSamples[0], samplesThisTime);
+
+        for (int i = 0; i < samplesThisTime; ++i, ++transitionPosition)
+        {
+            float fadeIn = juce::jlimit(0.f, 1.f, (float)(transitionPosition - transitionPrimeSamples) / (float)transitionFadeSamples);
+            samples[offset + i] = (fadeIn * samples[offset + i]) + ((1.f - fadeIn) * fadingSamples[(size_t)i]);
+        }
+    }
+
+    if (transitionPosition >= transitionPrimeSamples + transitionFadeSamples)
+        endTransition();
+}
+
+// Process the current window once and overlap-add the part of it that is synthesised into the output
+void SpectralSubtraction::processStreamFrame(const Config& config)
+{
+    ProcessingState& state = *config.processing;
+    const int hopSize = config.hopSize;
+    const int windowSize = config.windowSize;
+    const int synthesisSize = config.synthesisSize;
+
+    processFrame(config, state.streamInput.prepareToRead(windowSize), state.workspace);
+
+    // The frame goes in just after the finished output. If nothing is pulling, the oldest output is dropped to make room
+    CircularBuffer<float>& output = state.streamOutput;
+    if (output.getFreeSpace() < synthesisSize)
+        output.discard(synthesisSize - output.getFreeSpace());
+    CircularBuffer<float>::Regions<float*> window = output.prepareToWrite(synthesisSize);
+
+    // The frame overlaps the partial sums of earlier frames except for its last hop, which nothing has been added to yet.
+    // Everything before the synthesised part is silent, so the output starts from there
+    const int frameOffset = windowSize - synthesisSize;
+    accumulateFrame(config, state.workspace.output, frameOffset, window, 0, synthesisSize - hopSize, false);
+    accumulateFrame(config, state.workspace.output, frameOffset, window, synthesisSize - hopSize, synthesisSize, true);
+
+    // The first hop has now received every frame that overlaps it, and the oldest hop of input is no longer needed
+    output.finishedWrite(hopSize);
+    state.streamInput.discard(hopSize);
 }
 
 
@@ -163,32 +981,74 @@ void SpectralSubtraction::setSignal(juce::AudioSampleBuffer* buffer)
 }
 
 
-// Create frequency data from signal data
-SpectrumMatrix SpectralSubtraction::createFrequencyData(const Matrix& frames)
+// Create frequency data from signal data, returning the number of frames transformed
+int SpectralSubtraction::createFrequencyData(const Config& config, const FrameView& frames, SpectrumMatrix& frequencyData)
 {
-    int numFrames = frames.size();
-    SpectrumMatrix frequencyData(numFrames);
+    int numFrames = frames.getNumFrames();
+    jassert(numFrames <= (int)frequencyData.size());
+
+    FrameWorkspace& workspace = config.processing->workspace;
     for (int i = 0; i < numFrames; ++i)
     {
         // Transform to frequency domain
-        frequencyData[i] = frequencySpectrum(frames[i]);
+        frequencySpectrum(config, frames.getRegions(i), frequencyData[(size_t)i], workspace);
 
         // Update noise estimation
-        if (adaptiveEstimationEnabled && noiseEstimationEnabled)
+        updateAdaptiveEstimate(config, frequencyData[(size_t)i], workspace);
+    }
+    return numFrames;
+}
+
+// Update the adaptive noise estimation from a frame's spectrum if it is enabled
+void SpectralSubtraction::updateAdaptiveEstimate(const Config& config, const Spectrum& spectrum, FrameWorkspace& workspace)
+{
+    if (config.isEstimating())
+    {
+        Frame& magnitudes = workspace.magnitudes;
+        if (config.subtractionDomain == 1)
+            complexToMagnitudeSpectrum(spectrum, magnitudes);
+        else
+            complexToPowerSpectrum(spectrum, magnitudes);
+
+        if (config.perceptualBands != nullptr)
         {
-            Frame spectrum = subtractionDomain == 1 ? complexToMagnitudeSpectrum(frequencyData[i]) : complexToPowerSpectrum(frequencyData[i]);
-            updateNoiseEstimation(spectrum);
+            config.perceptualBands->binsToBands(&magnitudes[0], &workspace.bandValues[0]);
+            updateNoiseEstimation(config, workspace.bandValues);
         }
-
+        else
+            updateNoiseEstimation(config, magnitudes);
     }
-    return frequencyData;
 }
 
-// Generate a noise spectrum based on a buffer
+// Generate a noise spectrum based on a buffer at the device rate. Runs off the audio thread so it uses its own buffers
 Frame SpectralSubtraction::bufferToNoiseProfile(const std::vector<float>& buffer)
 {
-    Matrix noiseFrames = createSignalFrames(&buffer[0], buffer.size(), windowSize, hopSize);
-    return noiseAverageSpectrum(noiseFrames);
+    const Config& config = latestConfig();
+    if (config.decimationFactor == 1)
+        return noiseAverageSpectrum(config, FrameView(buffer.data(), (int)buffer.size(), config.windowSize, config.hopSize));
+
+    std::vector<float> band = decimateBuffer(config, buffer.data(), (int)buffer.size());
+    return noiseAverageSpectrum(config, FrameView(band.data(), (int)band.size(), config.windowSize, config.hopSize));
+}
+
+// Device rate samples needed for a noise profile, including the decimation filter's start
+int SpectralSubtraction::getNoiseProfileSize() const
+{
+    const Config& config = latestConfig();
+    return ((((config.noiseProfileFrames - 1) * config.hopSize) + config.windowSize) * config.decimationFactor) + config.resamplingDelay;
+}
+
+// Decimate a whole buffer to the processing rate, leaving out the samples the filter was still filling for
+std::vector<float> SpectralSubtraction::decimateBuffer(const Config& config, const float* samples, int numSamples)
+{
+    PolyphaseDecimator decimator;
+    decimator.prepare(config.decimationFactor);
+    std::vector<float> band((size_t)(numSamples / config.decimationFactor) + 1);
+    band.resize((size_t)decimator.process(samples, numSamples, band.data()));
+
+    int numFilling = juce::jmin((int)band.size(), config.resamplingDelay / config.decimationFactor);
+    band.erase(band.begin(), band.begin() + numFilling);
+    return band;
 }
 
 // Compute the noise spectrum based on a files signal
@@ -198,243 +1058,362 @@ Frame SpectralSubtraction::computeFileNoiseProfile()
         return Frame();
 
     // Assume that the first second of the signal contains only noise
-    int numSamples = getNoiseProfileSize();
+    int numSamples = juce::jmin(getNoiseProfileSize(), signal->getNumSamples());
 
     // Copy samples into buffer
-    std::vector<float> noiseBuffer(numSamples);
+    std::vector<float> noiseBuffer((size_t)numSamples);
     for (int i = 0; i < numSamples; ++i)
     {
-        noiseBuffer[i] = signal->getSample(0, i);
+        noiseBuffer[(size_t)i] = signal->getSample(0, i);
     }
 
     // Compute average noise estimation
     Frame estimate = bufferToNoiseProfile(noiseBuffer);
 
-    averageNoise = estimate;
+    setAverageNoise(estimate);
     return estimate;
 }
 
 
 // Averages the amplitude spectrum over the given frames
-Frame SpectralSubtraction::noiseAverageSpectrum(const Matrix& frames)
+Frame SpectralSubtraction::noiseAverageSpectrum(const Config& config, const FrameView& frames)
 {
-    Frame averageNoiseSpectrum;
-    int numFrames = frames.size();
-    Frame avgAmp(windowSize, 0);
+    int numFrames = frames.getNumFrames();
+    Frame averageNoiseSpectrum((size_t)config.numBins, 0);
+
+    FrameWorkspace workspace;
+    workspace.prepare(config.windowSize, config.fftType);
 
     // Loop through all frames
     for (int i = 0; i < numFrames; ++i) 
     {
         // Transform to frequency data
-        Spectrum temp = frequencySpectrum(frames[i]);
+        frequencySpectrum(config, frames.getRegions(i), workspace.spectrum, workspace);
 
         // Sum frequency data
-        for (int k = 0; k < windowSize; ++k)
-            avgAmp[k] += temp[k].magnitude();
-
+        complexToMagnitudeSpectrum(workspace.spectrum, workspace.magnitudes);
+        juce::FloatVectorOperations::add(&averageNoiseSpectrum[0], &workspace.magnitudes[0], config.numBins);
     }
 
     // Average
-    for (int i = 0; i < windowSize; ++i) 
-    {
-        averageNoiseSpectrum.push_back(avgAmp[i] / numFrames);
-    }
+    if (numFrames > 0)
+        juce::FloatVectorOperations::multiply(&averageNoiseSpectrum[0], 1.f / (float)numFrames, config.numBins);
 
     return averageNoiseSpectrum;
 }
 
 
 // Window and transform into frequency domain
-Spectrum SpectralSubtraction::frequencySpectrum(const Frame& frame)
+void SpectralSubtraction::frequencySpectrum(const Config& config, const FrameRegions& frame, Spectrum& spectrum, FrameWorkspace& workspace)
 {
-    int size = frame.size();
-    Frame fft_input(size, 0);
-    const Frame& currWindow = windows[windowType];
-    for (int j = 0; j < size; ++j) 
-    {
-        fft_input[j] = currWindow[j] * frame[j];
-    }
-    Spectrum fft_out = calculateFFT(fft_input);
-    return fft_out;
+    // Window straight from the source into the transform buffer
+    windowFrame(config, frame, spectrum.data());
+    calculateFFT(spectrum, workspace);
+}
+
+// Multiply a frame by the analysis window into destination. Each part is windowed where it lies, and
+// frames shorter than the window are zero padded
+void SpectralSubtraction::windowFrame(const Config& config, const FrameRegions& frame, float* destination)
+{
+    const float* window = config.getWindow().data();
+    int firstSize = juce::jlimit(0, config.windowSize, frame.firstSize);
+    int secondSize = juce::jlimit(0, config.windowSize - firstSize, frame.secondSize);
+
+    SpectralKernels::applyWindow(destination, frame.first, window, firstSize);
+    SpectralKernels::applyWindow(destination + firstSize, frame.second, window + firstSize, secondSize);
+    juce::FloatVectorOperations::clear(destination + firstSize + secondSize, config.windowSize - firstSize - secondSize);
 }
 
 
-// Run FFT on a single frame
-Spectrum SpectralSubtraction::calculateFFT(Frame& fft_input)
+// Run FFT in place on a windowed frame. The input is real so only the N/2 + 1 non-negative frequencies are kept
+void SpectralSubtraction::calculateFFT(Spectrum& spectrum, FrameWorkspace& workspace)
 {
-    int size = fft_input.size();
-    Spectrum result(size);
+    workspace.fft->performRealOnlyForwardTransform(spectrum.data());
+}
 
-    std::vector<juce::dsp::Complex<float>> input(size);
-    for (int i = 0; i < size; ++i) 
-    {
-        input[i] = juce::dsp::Complex<float>(fft_input[i], 0);
-    }
-    
-    std::vector<juce::dsp::Complex<float>> output(size);
-    
-    fft->perform(&input[0], &output[0], false);
-    
-    for (int i = 0; i < result.size(); ++i) 
+// Run IFFT in place on a single half spectrum frame
+void SpectralSubtraction::calculateIFFT(Spectrum& spectrum, Frame& result, FrameWorkspace& workspace)
+{
+    // Only the first N/2 + 1 bins are read, the negative frequencies are rebuilt from their conjugates
+    workspace.fft->performRealOnlyInverseTransform(spectrum.data());
+    juce::FloatVectorOperations::copy(&result[0], spectrum.data(), spectrum.getFFTSize());
+}
+
+// Create all window functions for the configuration's window size
+void SpectralSubtraction::createWindow(Config& config)
+{
+    std::shared_ptr<std::vector<Frame>> windows = std::make_shared<std::vector<Frame>>();
+    for (int i = 0; i < Window::numWindowingMethods; ++i)
     {
-        result[i] = Complex(output[i].real(), output[i].imag());
+        Frame tempWindow((size_t)config.windowSize, 0);
+        Window::fillWindowingTables(&tempWindow[0], (size_t)config.windowSize, (Window::WindowingMethod)i, true, 0.0);
+        int k = 2;
+        std::transform(tempWindow.begin(), tempWindow.end(), tempWindow.begin(), [k](float &c){ return c / (float)k;});
+        windows->push_back(tempWindow);
     }
-
-    return result;
+    config.windows = windows;
 }
 
-// Run IFFT on a single frame
-Frame SpectralSubtraction::calculateIFFT(Spectrum& ifft_input)
+// Calculate the gain that undoes the summed analysis windows at each position in a frame, and the
+// constant gain that does on average. The analysis windows keep a fixed scale whatever the hop, so noise
+// profiles stay valid when the overlap changes, and the overlap is made up for here
+void SpectralSubtraction::calculateOverlapScale(Config& config)
 {
-    int size = ifft_input.size();
-    Frame result(size, 0);
+    const int windowSize = config.windowSize;
+    const int hopSize = config.hopSize;
+    if (hopSize <= 0)
+        return;
 
-    std::vector<juce::dsp::Complex<float>> input(size);
-    for (int i = 0; i < size; ++i) {
-        input[i] = juce::dsp::Complex<float>(ifft_input[i].real, ifft_input[i].imag);
+    config.lowLatencyWindow = nullptr;
+    if (config.lowLatencyEnabled)
+    {
+        createLowLatencyWindows(config);
+        return;
     }
-    
-    std::vector<juce::dsp::Complex<float>> output(result.size());
-    
-    fft->perform(&input[0], &output[0], true);
-    
-    for (int i = 0; i < result.size(); ++i) {
-        result[i] = output[i].real();
+
+    const Frame& currWindow = config.getWindow();
+    Frame& overlapScale = config.overlapScale;
+    overlapScale.assign((size_t)windowSize, 1.f);
+
+    // Every sample in a hop is covered by the same set of window positions
+    double windowSum = 0;
+    for (int n = 0; n < hopSize; ++n)
+    {
+        double sum = 0;
+        for (int j = n; j < windowSize; j += hopSize)
+            sum += currWindow[(size_t)j];
+        windowSum += sum;
+
+        float scale = sum > 1e-6 ? (float)(1.0 / sum) : 1.f;
+        for (int j = n; j < windowSize; j += hopSize)
+            overlapScale[(size_t)j] = scale;
     }
 
- 
-    return result;
+    // Windows that overlap-add to a constant at this hop sum to the window's total over each hop
+    double constantSum = windowSum / hopSize;
+    config.overlapGain = constantSum > 1e-6 ? (float)(1.0 / constantSum) : 1.f;
 }
 
-// Sets how much each window overlaps 
-void SpectralSubtraction::setWindowOverlap(float overlap)
+// Build the asymmetric window pair for the low latency mode. The analysis window rises over the whole
+// frame less one hop and falls over its last hop, so it keeps the resolution of the full window. The
+// synthesis window only covers the last two hops, and the two multiply to a Hann window two hops long,
+// which overlap-adds to exactly one at the hop
+void SpectralSubtraction::createLowLatencyWindows(Config& config)
 {
-    windowOverlap = overlap;
-    hopSize = windowSize * (1.f - windowOverlap);
-}
+    const int windowSize = config.windowSize;
+    const int hopSize = config.hopSize;
+    const int synthesisStart = windowSize - config.synthesisSize;
+    const double pi = juce::MathConstants<double>::pi;
+
+    std::vector<double> analysis((size_t)windowSize);
+    for (int n = 0; n < windowSize - hopSize; ++n)
+        analysis[(size_t)n] = std::sin(pi * n / (2.0 * (windowSize - hopSize)));
+    for (int n = windowSize - hopSize; n < windowSize; ++n)
+        analysis[(size_t)n] = std::sin(pi * (n - synthesisStart) / (2.0 * hopSize));
+
+    // Scaled like the other windows, to a mean of one half, so noise profiles stay comparable
+    double sum = 0;
+    for (double a : analysis)
+        sum += a;
+    const double scale = sum > 0 ? (0.5 * windowSize) / sum : 1.0;
 
-// Create all window functions
-void SpectralSubtraction::createWindow()
-{
-    windows.clear();
-    for (int i = 0; i < Window::numWindowingMethods; ++i)
+    std::shared_ptr<Frame> window = std::make_shared<Frame>((size_t)windowSize);
+    config.overlapScale.assign((size_t)windowSize, 0.f);
+    for (int n = 0; n < windowSize; ++n)
     {
-        Frame tempWindow(windowSize, 0);
-        Window::fillWindowingTables(&tempWindow[0], windowSize, (Window::WindowingMethod)i, true, 0.0);
-        int k = 2;
-        std::transform(tempWindow.begin(), tempWindow.end(), tempWindow.begin(), [k](double &c){ return c / k;});
-        windows.push_back(tempWindow);
+        (*window)[(size_t)n] = (float)(analysis[(size_t)n] * scale);
+        if (n >= synthesisStart && analysis[(size_t)n] > 1e-9)
+        {
+            double product = std::pow(std::sin(pi * (n - synthesisStart) / (2.0 * hopSize)), 2.0);
+            config.overlapScale[(size_t)n] = (float)(product / (analysis[(size_t)n] * scale));
+        }
     }
+    config.lowLatencyWindow = window;
+    config.overlapGain = 1;
 }
 
-
-// Split the given buffer into overlapping frames
-Matrix SpectralSubtraction::createSignalFrames(const float* buffer, int size, int windowLength, int hopLength)
+// Add a processed frame into the output at its hop offset
+void SpectralSubtraction::overlapAddFrame(const Config& config, const Frame& frame, float* destination)
 {
-    // Calculate number of frames to fit in buffer
-    int numFrames = numberFrames(size, windowLength, hopLength); 
+    if (config.usesOverlapScale())
+        juce::FloatVectorOperations::addWithMultiply(destination, &frame[0], &config.overlapScale[0], config.windowSize);
+    else
+        juce::FloatVectorOperations::addWithMultiply(destination, &frame[0], config.overlapGain, config.windowSize);
+}
 
-    if (size < windowLength)
-        numFrames = 1;
 
-    Matrix frames(numFrames);
+// Add samples [from, to) of a window of the output ring into it, or overwrite what is there. The window starts
+// frameOffset samples into the frame
+void SpectralSubtraction::accumulateFrame(const Config& config, const Frame& frame, int frameOffset, const CircularBuffer<float>::Regions<float*>& window, int from, int to, bool overwrite)
+{
+    const float* samples = frame.data() + frameOffset;
+    const float* scale = config.overlapScale.data() + frameOffset;
+    const bool normalise = config.usesOverlapScale();
 
-    // Create each frame
-    for (int i = 0; i < numFrames; ++i)
+    // The window wraps into its second part after firstSize samples
+    for (int part = 0; part < 2; ++part)
     {
-        Frame window(windowLength);
-        for (int j = 0; j < windowLength; ++j)
+        const int partStart = part == 0 ? 0 : window.firstSize;
+        const int partEnd = part == 0 ? window.firstSize : window.size();
+        const int start = juce::jmax(from, partStart);
+        const int numSamples = juce::jmin(to, partEnd) - start;
+        if (numSamples <= 0)
+            continue;
+
+        float* destination = (part == 0 ? window.first : window.second) + (start - partStart);
+        if (overwrite)
         {
-            int index = (i * hopLength) + j;
-            window[j] = (index < size) ? buffer[index] : 0;
+            if (normalise)
+                juce::FloatVectorOperations::multiply(destination, samples + start, scale + start, numSamples);
+            else
+                juce::FloatVectorOperations::multiply(destination, samples + start, config.overlapGain, numSamples);
+        }
+        else
+        {
+            if (normalise)
+                juce::FloatVectorOperations::addWithMultiply(destination, samples + start, scale + start, numSamples);
+            else
+                juce::FloatVectorOperations::addWithMultiply(destination, samples + start, config.overlapGain, numSamples);
         }
-        frames[i] = window;
     }
-    return frames;
 }
 
 
-
-// Deframe samples using overlap and add to convert to output signal
-std::vector<float> SpectralSubtraction::createSamplesFromFrames(const Matrix& frames, int windowLength, int hopLength)
+// Deframe samples using overlap and add to convert to output signal, returning the number of samples written
+int SpectralSubtraction::createSamplesFromFrames(const Config& config, const Matrix& frames, int numFrames, int windowLength, int hopLength, std::vector<float>& samples)
 {
     // Calculate number of samples from frames
-    int numFrames = frames.size();
-    int numSamples = (numFrames * windowLength) - ((numFrames - 1) * hopLength);
-    std::vector<float> samples(numSamples);
-    
-    // Overlap and add frames
-    for (int n = 0; n < numSamples; ++n)
+    int numSamples = ((numFrames - 1) * hopLength) + windowLength;
+    jassert(numSamples <= (int)samples.size());
+    jassert(windowLength == config.windowSize);
+
+    // Each frame is added once at its hop offset
+    juce::FloatVectorOperations::clear(&samples[0], numSamples);
+    for (int m = 0; m < numFrames; ++m)
     {
-        double sum = 0;
-        for (int m = 0; m < numFrames; ++m)
-        {
-            int index = n - (m * hopLength);
-            if (index >= 0 && index < windowLength)
-            {
-                sum += frames[m][index];
-            }
-        }
-        samples[n] = sum;
+        overlapAddFrame(config, frames[(size_t)m], samples.data() + (m * hopLength));
     }
 
-    return samples;
+    return numSamples;
 }
 
 // Calculate the start and end frequencies for each band
-void SpectralSubtraction::calculateFrequencyBands()
+void SpectralSubtraction::calculateFrequencyBands(Config& config)
 {
-    frequencyBandRanges.clear();
+    const int numBins = config.numBins;
+    const int numFrequencyBands = config.numFrequencyBands;
+    config.frequencyBandRanges.clear();
 
-    float width = windowSize / (float)numFrequencyBands;
+    // Bands cover the non-negative frequencies, the last band ends on the Nyquist bin
+    float width = (float)numBins / (float)numFrequencyBands;
     for (int i = 0; i < numFrequencyBands; ++i)
     {
-        int start = (int)(i * width);
-        int end = (int)(start + width);
+        int start = (int)((float)i * width);
+        int end = (i == numFrequencyBands - 1) ? numBins : (int)((float)(i + 1) * width);
         std::pair<int, int> range(start, end);
-        frequencyBandRanges.push_back(range);
+        config.frequencyBandRanges.push_back(range);
     }
 }
 
-// Calculates the segmental SNR. ie. the ratio between the average of the noisy signal and the noise estimate
-double SpectralSubtraction::segmentalSNR(const Spectrum& currFrame, const Frame& estimateFrame, const std::pair<int, int>& range)
+// Build the band table for the bins and rate, and the per band copies of the settings kept per bin. Each band
+// takes the weight of the frequency band its centre is in
+void SpectralSubtraction::calculatePerceptualBands(Config& config)
 {
-    double a = sumSpectrum(currFrame, range) / sumFrame(estimateFrame, range);
-    double snr = 10.0 * std::log10(a);
-    return snr;
-}
+    if (!config.perceptualBandsEnabled)
+    {
+        config.perceptualBands = nullptr;
+        config.perceptualBandWeights.clear();
+        config.averageBandNoise.clear();
+        return;
+    }
 
-// Sums the magnitude of a given spectrum
-double SpectralSubtraction::sumSpectrum(const Spectrum& frame, const std::pair<int, int>& range)
-{
-    double sum = 0;
-    for (int i = range.first; i < range.second; ++i)
+    const float rate = config.sampleRate / (float)config.decimationFactor;
+    if (config.perceptualBands == nullptr || !config.perceptualBands->matches(config.numBins, rate, config.numPerceptualBands))
+        config.perceptualBands = std::make_shared<PerceptualBands>(config.numBins, rate, config.numPerceptualBands);
+
+    const PerceptualBands& bands = *config.perceptualBands;
+    const int numBands = bands.getNumBands();
+    config.perceptualBandWeights.assign((size_t)numBands, 1);
+    for (int b = 0; b < numBands; ++b)
+    {
+        const int centre = juce::roundToInt(bands.getCentreBin(b));
+        for (int n = 0; n < (int)config.frequencyBandRanges.size(); ++n)
+        {
+            if (centre >= config.frequencyBandRanges[(size_t)n].first && centre < config.frequencyBandRanges[(size_t)n].second)
+                config.perceptualBandWeights[(size_t)b] = (float)config.bandWeights[(size_t)n];
+        }
+    }
+
+    config.averageBandNoise.clear();
+    if ((int)config.averageNoise.size() == config.numBins)
     {
-        double mag = frame[i].magnitude();
-        sum += subtractionDomain == 1 ? mag : mag * mag;
+        config.averageBandNoise.assign((size_t)numBands, 0);
+        bands.binsToBands(&config.averageNoise[0], &config.averageBandNoise[0]);
     }
-    return sum;
+}
+
+// Minimum tracking's smoothing factors for the hop, so its time constants stay the same at any size, overlap and rate.
+// The sub-windows together span the minimum window, and the speech threshold is on magnitudes in the magnitude domain
+void SpectralSubtraction::calculateMinimumTracking(Config& config)
+{
+    const float hopTime = (float)config.hopSize / (config.sampleRate / (float)config.decimationFactor);
+    config.minimumSmoothing = std::exp(-hopTime / minimumSmoothingTime);
+    config.presenceSmoothing = std::exp(-hopTime / presenceSmoothingTime);
+    config.trackingSmoothing = std::exp(-hopTime / trackingSmoothingTime);
+
+    const int windowFrames = (int)std::ceil(minimumWindowTime / hopTime);
+    config.subWindowFrames = juce::jmax(1, (windowFrames + EstimationState::minimumSubWindows - 1) / EstimationState::minimumSubWindows);
+    config.presenceThreshold = config.subtractionDomain == 1 ? std::sqrt(speechPowerRatio) : speechPowerRatio;
+}
+
+// Spread per band values over the bins of the newest configuration. Anything else is returned as it is
+Frame SpectralSubtraction::bandsToBins(const Frame& values) const
+{
+    const Config& config = latestConfig();
+    if (config.perceptualBands == nullptr || (int)values.size() != config.perceptualBands->getNumBands())
+        return values;
+
+    Frame bins((size_t)config.numBins, 0);
+    config.perceptualBands->bandsToBins(&values[0], &bins[0]);
+    return bins;
+}
+
+// The noise subtracted from the last frame, per bin
+Frame SpectralSubtraction::getNoiseSubtracted() const
+{
+    const Config& config = latestConfig();
+    const FrameWorkspace& workspace = config.processing->workspace;
+    if (config.perceptualBands == nullptr)
+        return workspace.subtracted;
+
+    Frame bins((size_t)config.numBins, 0);
+    config.perceptualBands->bandsToBins(&workspace.bandSubtracted[0], &bins[0]);
+    return bins;
+}
+
+// Calculates the segmental SNR. ie. the ratio between the average of the noisy signal and the noise estimate
+double SpectralSubtraction::segmentalSNR(const Frame& noisySpectrum, const Frame& estimateFrame, const std::pair<int, int>& range)
+{
+    double a = sumFrame(noisySpectrum, range) / sumFrame(estimateFrame, range);
+    double snr = 10.0 * std::log10(a);
+    return snr;
 }
 
 // Sums the values in a given frame
 double SpectralSubtraction::sumFrame(const Frame& frame, const std::pair<int, int>& range)
 {
-    double sum = 0;
-    for (int i = range.first; i < range.second; ++i)
-    {
-        sum += frame[i];
-    }
-    return sum;
+    return SpectralKernels::sum(&frame[0], range.first, range.second);
 }
 
 // Calculates the over subtraction factor based on the segmental SNR
-double SpectralSubtraction::calculateOverSubtraction(double snr)
+double SpectralSubtraction::calculateOverSubtraction(const Config& config, double snr)
 {
+    const double subtractionAlpha = config.subtractionAlpha;
     if (snr < SNR_min)
         return subtractionAlpha;
     else if (snr >= SNR_min && snr <= SNR_max)
     {
-        float y = (alpha_min - subtractionAlpha) / (SNR_max - SNR_min);
+        float y = (float)((alpha_min - subtractionAlpha) / (SNR_max - SNR_min));
         return subtractionAlpha + (snr - SNR_min) * y;
     }
     else
@@ -443,115 +1422,225 @@ double SpectralSubtraction::calculateOverSubtraction(double snr)
 }
 
 // Converts a spectrum to a frame of power values
-Frame SpectralSubtraction::complexToPowerSpectrum(const Spectrum& spectrum)
+void SpectralSubtraction::complexToPowerSpectrum(const Spectrum& spectrum, Frame& powerSpectrum)
 {
-    int size = spectrum.size();
-    Frame powerSpectrum(size);
-    for (int i = 0; i < size; ++i)
-    {
-        double mag = spectrum[i].magnitude();
-        powerSpectrum[i] = mag * mag;
-    }
-    return powerSpectrum;
+    SpectralKernels::power(&powerSpectrum[0], spectrum.data(), spectrum.getNumBins());
 }
 
 // Converts a spectrum to a frame of magnitude values
-Frame SpectralSubtraction::complexToMagnitudeSpectrum(const Spectrum& spectrum)
+void SpectralSubtraction::complexToMagnitudeSpectrum(const Spectrum& spectrum, Frame& magnitudeSpectrum)
 {
-    int size = spectrum.size();
-    Frame powerSpectrum(size);
-    for (int i = 0; i < size; ++i)
-    {
-        powerSpectrum[i] = spectrum[i].magnitude();
-    }
-    return powerSpectrum;
+    SpectralKernels::magnitude(&magnitudeSpectrum[0], spectrum.data(), spectrum.getNumBins());
 }
 
 
 // Updates the noise estimation by interpolating between the input and running mean
-void SpectralSubtraction::updateNoiseEstimation(const Frame& powerSpectrum)
+void SpectralSubtraction::updateNoiseEstimation(const Config& config, const Frame& powerSpectrum)
 {
+    if (config.noiseEstimator == minimumTracking)
+    {
+        trackNoiseMinimum(config, powerSpectrum);
+        return;
+    }
 
-    if (frameNumber < noiseProfileFrames)
+    EstimationState& estimation = *config.estimation;
+    const int numEstimates = config.getNumEstimates();
+    int capacity = (int)estimation.noiseEstimation.size();
+
+    if (estimation.noiseEstimationCount < capacity)
     {
-        noiseEstimation.push_back(powerSpectrum);
-        ++frameNumber;
+        // Until the ring is full the oldest frame stays at index 0
+        Frame& newFrame = estimation.noiseEstimation[(size_t)estimation.noiseEstimationCount];
+        std::copy(powerSpectrum.begin(), powerSpectrum.begin() + numEstimates, newFrame.begin());
+        for (int w = 0; w < numEstimates; ++w)
+            estimation.noiseEstimationSum[(size_t)w] += newFrame[(size_t)w];
+        ++estimation.noiseEstimationCount;
     }
     else
     {
-        const Frame& prevFrame = noiseEstimation.front();
-        Frame estimation(powerSpectrum.size());
-        for (int w = 0; w < windowSize; ++w)
+        // The oldest frame is replaced in place by the new estimate
+        Frame& prevFrame = estimation.noiseEstimation[(size_t)estimation.noiseEstimationStart];
+        for (int w = 0; w < numEstimates; ++w)
         {
-            double snr = aposterioriSNR(powerSpectrum, w);
-            a_SNR[w] = snr;
-            double smoothing = calculateSmoothingParameter(snr);
-            estimationSmoothing[w] = smoothing;
-            const double& power = powerSpectrum[w];
-
-            estimation[w] = (smoothing * prevFrame[w]) +
-                ((1.0 - smoothing) * power);
+            double snr = aposterioriSNR(config, powerSpectrum, w);
+            estimation.a_SNR[(size_t)w] = (float)snr;
+            const float smoothing = (float)calculateSmoothingParameter(config, snr);
+            estimation.estimationSmoothing[(size_t)w] = smoothing;
+            const float power = powerSpectrum[(size_t)w];
+
+            float estimate = (smoothing * prevFrame[(size_t)w]) +
+                ((1.0f - smoothing) * power);
+
+            // The running sum swaps the oldest value for the newest
+            estimation.noiseEstimationSum[(size_t)w] += estimate - prevFrame[(size_t)w];
+            prevFrame[(size_t)w] = estimate;
         }
-        noiseEstimation.pop_front();
-        noiseEstimation.push_back(estimation);
+        estimation.noiseEstimationStart = (estimation.noiseEstimationStart + 1) % capacity;
+
+        // Resum once per lap of the ring so rounding in the running sum never accumulates
+        if (estimation.noiseEstimationStart == 0)
+            resumNoiseEstimation(estimation, numEstimates);
     }
     
 }
 
+// Minima controlled recursive averaging. The values are smoothed over time and across their neighbours, and the minimum
+// of the smoothing over the last minimumSubWindows sub-windows follows the noise floor, through speech as well. Where the
+// smoothing is well above that minimum speech is likely, and the estimate averages the values only as fast as it is absent.
+// Only multiplies, adds and compares run per frame, the minimum over the sub-windows is taken once per sub-window
+void SpectralSubtraction::trackNoiseMinimum(const Config& config, const Frame& values)
+{
+    EstimationState& estimation = *config.estimation;
+    const int numEstimates = config.getNumEstimates();
+    Frame& smoothed = estimation.smoothedValues;
+    Frame& minimum = estimation.trackedMinimum;
+    Frame& presence = estimation.speechPresence;
+    Frame& noise = estimation.trackedNoise;
+
+    // Every minimum and the estimate start from the first frame
+    if (!estimation.trackingStarted)
+    {
+        std::copy(values.begin(), values.begin() + numEstimates, smoothed.begin());
+        std::copy(values.begin(), values.begin() + numEstimates, estimation.subWindowMinimum.begin());
+        for (Frame& subWindow : estimation.subWindowMinima)
+            std::copy(values.begin(), values.begin() + numEstimates, subWindow.begin());
+        std::copy(values.begin(), values.begin() + numEstimates, minimum.begin());
+        std::copy(values.begin(), values.begin() + numEstimates, noise.begin());
+        std::fill(presence.begin(), presence.end(), 0.f);
+        std::fill(estimation.estimationSmoothing.begin(), estimation.estimationSmoothing.end(), config.trackingSmoothing);
+        estimation.subWindowPosition = 0;
+        estimation.subWindowIndex = 0;
+        estimation.trackingStarted = true;
+        return;
+    }
+
+    // Smoothed over time, and across neighbours by 1/4, 1/2, 1/4 with the edges repeated
+    const float a = config.minimumSmoothing;
+    const float b = (1.f - a) * 0.25f;
+    const size_t last = (size_t)numEstimates - 1;
+    smoothed[0] = (a * smoothed[0]) + (b * ((3.f * values[0]) + values[juce::jmin((size_t)1, last)]));
+    for (size_t k = 1; k < last; ++k)
+        smoothed[k] = (a * smoothed[k]) + (b * (values[k - 1] + (2.f * values[k]) + values[k + 1]));
+    if (last > 0)
+        smoothed[last] = (a * smoothed[last]) + (b * (values[last - 1] + (3.f * values[last])));
+
+    juce::FloatVectorOperations::min(&estimation.subWindowMinimum[0], &estimation.subWindowMinimum[0], &smoothed[0], numEstimates);
+    juce::FloatVectorOperations::min(&minimum[0], &minimum[0], &smoothed[0], numEstimates);
+
+    // The chance of speech follows whether the smoothing is above the threshold, and slows the estimate down
+    const float threshold = config.presenceThreshold;
+    const float presenceSmoothing = config.presenceSmoothing;
+    const float trackingSmoothing = config.trackingSmoothing;
+    for (size_t k = 0; k < (size_t)numEstimates; ++k)
+    {
+        const float present = smoothed[k] > threshold * minimum[k] ? 1.f - presenceSmoothing : 0.f;
+        presence[k] = (presenceSmoothing * presence[k]) + present;
+        const float smoothing = trackingSmoothing + ((1.f - trackingSmoothing) * presence[k]);
+        noise[k] += (1.f - smoothing) * (values[k] - noise[k]);
+        estimation.estimationSmoothing[k] = smoothing;
+    }
+
+    // A finished sub-window replaces the oldest one, and the minimum starts over from the ones kept
+    if (++estimation.subWindowPosition >= config.subWindowFrames)
+    {
+        Frame& finished = estimation.subWindowMinima[(size_t)estimation.subWindowIndex];
+        std::copy(estimation.subWindowMinimum.begin(), estimation.subWindowMinimum.begin() + numEstimates, finished.begin());
+        estimation.subWindowIndex = (estimation.subWindowIndex + 1) % EstimationState::minimumSubWindows;
+
+        std::copy(estimation.subWindowMinima[0].begin(), estimation.subWindowMinima[0].begin() + numEstimates, minimum.begin());
+        for (int u = 1; u < EstimationState::minimumSubWindows; ++u)
+            juce::FloatVectorOperations::min(&minimum[0], &minimum[0], &estimation.subWindowMinima[(size_t)u][0], numEstimates);
+
+        std::copy(smoothed.begin(), smoothed.begin() + numEstimates, estimation.subWindowMinimum.begin());
+        estimation.subWindowPosition = 0;
+    }
+}
+
+// Recalculates the running sum of every frame in the estimation ring
+void SpectralSubtraction::resumNoiseEstimation(EstimationState& estimation, int numEstimates)
+{
+    std::fill(estimation.noiseEstimationSum.begin(), estimation.noiseEstimationSum.end(), 0);
+    for (int p = 0; p < estimation.noiseEstimationCount; ++p)
+    {
+        const Frame& frame = estimation.noiseEstimation[(size_t)p];
+        for (int w = 0; w < numEstimates; ++w)
+            estimation.noiseEstimationSum[(size_t)w] += frame[(size_t)w];
+    }
+}
+
 // Resets the estimation frames
-void SpectralSubtraction::resetEstimation()
+void SpectralSubtraction::clearEstimation(EstimationState& estimation)
+{
+    std::fill(estimation.a_SNR.begin(), estimation.a_SNR.end(), 0.f);
+    std::fill(estimation.estimationSmoothing.begin(), estimation.estimationSmoothing.end(), 0.f);
+    std::fill(estimation.noiseEstimationSum.begin(), estimation.noiseEstimationSum.end(), 0);
+    estimation.noiseEstimationStart = 0;
+    estimation.noiseEstimationCount = 0;
+
+    // The tracking arrays are filled from the first frame after a reset
+    estimation.subWindowPosition = 0;
+    estimation.subWindowIndex = 0;
+    estimation.trackingStarted = false;
+}
+
+// Clear the estimate if the settings thread asked for a reset since it was last cleared
+void SpectralSubtraction::applyEstimationResets(const Config& config)
 {
-    std::fill(a_SNR.begin(), a_SNR.end(), 0.f);
-    std::fill(estimationSmoothing.begin(), estimationSmoothing.end(), 0.f);
-    frameNumber = 0;
-    noiseEstimation.clear();
+    EstimationState& estimation = *config.estimation;
+    if (estimation.estimationResets != config.estimationResets)
+    {
+        clearEstimation(estimation);
+        estimation.estimationResets = config.estimationResets;
+    }
 }
 
 // Calculates the estimation smoothing value based on a-posteriori SNR
-double SpectralSubtraction::calculateSmoothingParameter(double snr)
+double SpectralSubtraction::calculateSmoothingParameter(const Config& config, double snr)
 {
-    float e = std::exp(-smoothingRate * (snr - smoothingCurve));
+    float e = (float)std::exp(-config.smoothingRate * (snr - config.smoothingCurve));
     double smoothing = 1.0 / (1.0 + e);
     return smoothing;
 }
 
 
 // Ratio of the noisy signal and the noise estimate
-double SpectralSubtraction::aposterioriSNR(const Frame& powerSpectrum, int omega)
+double SpectralSubtraction::aposterioriSNR(const Config& config, const Frame& powerSpectrum, int omega)
 {
-    double m = 1.0 / (double)noiseProfileFrames;
+    double m = 1.0 / (double)config.noiseProfileFrames;
 
-    double sum = 0;
-    for (int p = 0; p < noiseEstimation.size(); ++p)
-    {
-        sum += noiseEstimation[p][omega];
-    }
-    double power = powerSpectrum[omega];
-    double snr = 10.0 * std::log10(power / (m * sum));
+    double power = powerSpectrum[(size_t)omega];
+    double snr = 10.0 * std::log10(power / (m * config.estimation->noiseEstimationSum[(size_t)omega]));
 
     return snr;
 }
 
 // Ratio between the clean speech signal and the noise estimate
-double SpectralSubtraction::aprioriSNR(const Frame& speechSpectrum, double apostSNR, int omega)
+double SpectralSubtraction::aprioriSNR(const Config& config, const Frame& speechSpectrum, double apostSNR, int omega)
 {
-    double sum = 0;
-    double m = 1.0 / (double)noiseProfileFrames;
-    for (int p = 0; p < noiseEstimation.size(); ++p)
-    {
-        sum += noiseEstimation[p][omega];
-    }
-    double snr = 10.0 * std::log10(speechSpectrum[omega] / (m * sum));
+    double m = 1.0 / (double)config.noiseProfileFrames;
+    double snr = 10.0 * std::log10(speechSpectrum[(size_t)omega] / (m * config.estimation->noiseEstimationSum[(size_t)omega]));
     snr += (1.0 - snrQuality) * std::max(apostSNR - 1, 0.0);
     return snr;
 }
 
 
 // Gets the noise estimation based on settings
-const Frame* SpectralSubtraction::getNoiseEstimation() const 
+const Frame* SpectralSubtraction::getNoiseEstimation(const Config& config) const 
 {
-    if (adaptiveEstimationEnabled)
-        return noiseEstimation.size() > 0 ? &noiseEstimation.back() : nullptr;
+    if (config.adaptiveEstimationEnabled)
+    {
+        const EstimationState& estimation = *config.estimation;
+        if (config.noiseEstimator == minimumTracking)
+            return estimation.trackingStarted ? &estimation.trackedNoise : nullptr;
+        if (estimation.noiseEstimationCount == 0)
+            return nullptr;
+
+        // Newest frame sits just before the oldest once the ring has wrapped
+        int newest = (estimation.noiseEstimationStart + estimation.noiseEstimationCount - 1) % (int)estimation.noiseEstimation.size();
+        return &estimation.noiseEstimation[(size_t)newest];
+    }
+    else if (config.perceptualBands != nullptr)
+        return config.averageBandNoise.size() > 0 ? &config.averageBandNoise : nullptr;
     else
-        return averageNoise.size() > 0 ? &averageNoise : nullptr;
+        return config.averageNoise.size() > 0 ? &config.averageNoise : nullptr;
 }
@@ -9,196 +9,551 @@
 */
 
 #pragma once
-#include <JuceHeader.h>
+#include <juce_dsp/juce_dsp.h>
+#include "SpectralKernels.h"
 #include "CircularBuffer.h"
+#include "FFTBackend.h"
+#include "PolyphaseResampler.h"
+#include "PerceptualBands.h"
 
 
 
 
-struct Complex
+typedef std::vector<float> Frame;
+typedef std::vector<Frame> Matrix;
+typedef juce::dsp::WindowingFunction<float> Window;
+
+
+// A half spectrum of N/2 + 1 bins, stored as interleaved (real, imag) floats exactly as the
+// real-only FFT writes them so frames are transformed in place. Holds 2N floats since the
+// transform uses the rest as scratch
+class Spectrum
 {
-    Complex() : real(0), imag(0) {}
-    Complex(double r, double i) : real(r), imag(i) {}
-
-    double magnitude() const {
-        return std::sqrt((real * real) + (imag * imag));
-    }
-
-    double phase() const {
-        if (real > 0)
-            return std::atan(imag / real);
-        else if (real < 0)
-            return std::atan(imag / real) + juce::MathConstants<double>::pi;
-        return 0.0;
-    }
-
-    std::pair<double, double> polar() {
-        return std::make_pair<double, double>(magnitude(), phase());
-    }
-
-    Complex conjugate() const {
-        return Complex(real, -imag);
-    }
-
-    double real;
-    double imag;
+public:
+    Spectrum() {}
+    explicit Spectrum(int size) { setSize(size); }
+    Spectrum(const Spectrum& other) { *this = other; }
+    Spectrum& operator=(const Spectrum& other);
+
+    void setSize(int fftSize);
+
+    float* data() { return bins; }
+    const float* data() const { return bins; }
+    int getNumBins() const { return numBins; }
+    int getFFTSize() const { return fftSize; }
+
+private:
+    std::vector<float> storage;
+    float* bins = nullptr;
+    int fftSize = 0;
+    int numBins = 0;
 };
 
-typedef std::vector<double> Frame;
-typedef std::vector<Complex> Spectrum;
-typedef std::vector<Frame> Matrix;
 typedef std::vector<Spectrum> SpectrumMatrix;
-typedef juce::dsp::WindowingFunction<double> Window;
+
+// A frame read as up to two contiguous parts, the second is only used when it wraps around a ring
+typedef CircularBuffer<float>::Regions<const float*> FrameRegions;
+
+
+// A non-owning view of the overlapping frames in a buffer of samples. Frame i starts i hops into
+// the buffer, frames that reach past the end are zero padded when they are windowed
+struct FrameView
+{
+    FrameView(const float* buffer, int size, int windowLength, int hopLength);
+
+    int getNumFrames() const { return numFrames; }
+    const float* getFrame(int index) const { return samples + (index * hopSize); }
+    int getFrameLength(int index) const { return juce::jmin(windowSize, numSamples - (index * hopSize)); }
+    FrameRegions getRegions(int index) const { return { getFrame(index), getFrameLength(index), nullptr, 0 }; }
+
+    const float* samples;
+    int numSamples;
+    int windowSize;
+    int hopSize;
+    int numFrames;
+};
+
+
+// FFT and scratch buffers for processing a single frame. Each thread that processes frames needs
+// its own, FFT engines may keep scratch space of their own
+struct FrameWorkspace
+{
+    void prepare(int fftSize, FFTBackend::Type fftType);
+
+    std::unique_ptr<FFTBackend> fft;
+    Spectrum spectrum;
+    Frame magnitudes;
+    Frame gains;
+    Frame subtracted;
+    Frame output;
+
+    // Per band values when gains are computed on perceptual bands
+    Frame bandValues;
+    Frame bandGains;
+    Frame bandSubtracted;
+};
 
 
+// Settings are changed on one thread, usually the message thread, and published as an immutable
+// configuration. processBuffer and the stream may run on another thread at the same time, they pick
+// up the newest configuration at the start of each block without locking. renderBuffer and the noise
+// profile functions run on the thread that changes settings. A new fft size is built on a background
+// thread and published when it is complete, the stream crossfades into it. The stream, renderBuffer and the
+// noise profile functions take samples at the device rate and process them at the processing rate, processBuffer
+// and processSubtraction work at the processing rate
 class SpectralSubtraction
 {
     public:
         SpectralSubtraction(int fft_order);
         ~SpectralSubtraction();
 
+        // How the adaptive estimate follows the noise. The smoothed estimator averages every frame while noise
+        // estimation is on, so it is only on during noise. Minimum tracking takes the noise floor from the minimum
+        // of the smoothed spectrum over the last second and a half, and keeps updating through speech
+        enum NoiseEstimator
+        {
+            smoothedEstimator = 0,
+            minimumTracking
+        };
+
         // Processing
+        void prepare(int maxBlockSize, int fft_order) { prepareFFTSize(maxBlockSize, 1 << fft_order); }
+        void prepareFFTSize(int maxBlockSize, int fftSize);
         void processBuffer(float* buffer, int size);
-        Matrix processSubtraction(const std::vector<Spectrum>& frequencyData);
+        int processSubtraction(const SpectrumMatrix& frequencyData, int numFrames, Matrix& output);
+        void renderBuffer(const float* input, float* output, int numSamples, juce::ThreadPool* pool = nullptr);
+
+        // Streaming, each frame is processed once per hop
+        void pushSamples(const float* samples, int numSamples);
+        int pullSamples(float* samples, int numSamples);
+        int pullSamples(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+        juce::int64 getUnderrunSamples() const { return underrunSamples.load(); }
+        void resetStream() { updateConfig([](Config& c) { ++c.streamResets; }); }
+        int getLatencySamples() const { return latestConfig().latencySamples; }
 
         // Signal
         void setSignal(juce::AudioSampleBuffer* buffer);
         juce::AudioSampleBuffer* getSignal() const { return signal; }
         bool isSignalSet() { return signal != nullptr; }
-        void setSampleRate(float rate) { sampleRate = rate; }
+        float getSampleRate() const { return latestConfig().sampleRate; }
+        void setSampleRate(float rate) { updateConfig([=](Config& c) { c.sampleRate = rate; }); }
 
         // Noise profile
         Frame computeFileNoiseProfile();
         Frame bufferToNoiseProfile(const std::vector<float>& buffer);
-        const Frame& getAverageNoise() const { return averageNoise; }
-        void setAverageNoise(const Frame& noise) { averageNoise = noise; }
-        void setNoiseProfileFrames(int numFrames) { noiseProfileFrames = numFrames; }
-        int getNoiseProfileSize() { return (noiseProfileFrames * windowSize) - ((noiseProfileFrames - 1) * hopSize); }
-        const Frame* getNoiseEstimation() const;
-        void updateNoiseEstimation(const Frame& powerSpectrum);
-        const Frame& getAPosSNR() const { return a_SNR; }
-        const Frame& getEstimationSmoothing() const { return estimationSmoothing; }
-        void resetEstimation();
-        const Frame& getNoiseSubtracted() { return noiseSubtracted; }
+        const Frame& getAverageNoise() const { return latestConfig().averageNoise; }
+        void setAverageNoise(const Frame& noise) { updateConfig([&](Config& c) { c.averageNoise = noise; c.averageNoiseFactor = c.decimationFactor; }); }
+        void setNoiseProfileFrames(int numFrames) { updateConfig([=](Config& c) { c.noiseProfileFrames = numFrames; }); }
+        int getNoiseProfileSize() const;
+        const Frame* getNoiseEstimation() const { return getNoiseEstimation(latestConfig()); }
+        void updateNoiseEstimation(const Frame& powerSpectrum) { updateNoiseEstimation(acquireConfig(), powerSpectrum); }
+        const Frame& getAPosSNR() const { return latestConfig().estimation->a_SNR; }
+        const Frame& getEstimationSmoothing() const { return latestConfig().estimation->estimationSmoothing; }
+        void resetEstimation() { updateConfig([](Config& c) { ++c.estimationResets; }); }
+        Frame getNoiseSubtracted() const;
 
         // Window
-        const Frame& getWindow() const { return windows[windowType]; }
-        const std::vector<Frame>& getWindows() const { return windows; }
-        int getWindowSize() const { return windowSize;}
-        Window::WindowingMethod getWindowType() const { return windowType; }
-        void setWindowType(Window::WindowingMethod windowMethod) { windowType = windowMethod; }
-        int numberFrames(int size, int windowLength, int hopLength) { return 1 + std::floor((size - windowLength) / (float)hopLength);}
-        void setWindowOverlap(float overlap);
-        float getWindowOverlap() const { return windowOverlap; }
-
-        // FFT Order
-        int getFFTOrder() const { return order; }
-        void setFFTOrder(int fft_order);
+        const Frame& getWindow() const { return latestConfig().getWindow(); }
+        const std::vector<Frame>& getWindows() const { return *latestConfig().windows; }
+        int getWindowSize() const { return latestConfig().windowSize; }
+        int getNumBins() const { return latestConfig().numBins; }
+        Window::WindowingMethod getWindowType() const { return latestConfig().windowType; }
+        void setWindowType(Window::WindowingMethod windowMethod) { updateConfig([=](Config& c) { c.windowType = windowMethod; }); }
+        int numberFrames(int size, int windowLength, int hopLength) { return 1 + (int)std::floor((float)(size - windowLength) / (float)hopLength);}
+        void setWindowOverlap(float overlap) { updateConfig([=](Config& c) { c.windowOverlap = overlap; }); }
+        float getWindowOverlap() const { return latestConfig().windowOverlap; }
+
+        // FFT Size at the device rate. Any even size whose half has no prime factor above 5 is used as it is, other sizes
+        // are rounded up to the next one. At a reduced processing rate the window keeps its length in time, so it is this
+        // size over the decimation factor, rounded up the same way. The order is of the largest power of two that fits
+        int getFFTSize() const { return latestConfig().NFFT; }
+        void setFFTSize(int fftSize);
+        int getFFTOrder() const { return juce::findHighestSetBit((juce::uint32)getFFTSize()); }
+        void setFFTOrder(int fft_order) { setFFTSize(1 << fft_order); }
+        bool isRebuildPending() const { return requestedSize.load() != getFFTSize(); }
+
+        // FFT Backend, automatic uses whichever engine was fastest for the size on this machine. A type that
+        // can't do the size is treated as automatic, the getter returns the type in use
+        FFTBackend::Type getFFTBackend() const { return latestConfig().fftType; }
+        const char* getFFTBackendName() const { return FFTBackend::getTypeName(getFFTBackend()); }
+        void setFFTBackend(FFTBackend::Type type) { updateConfig([=](Config& c) { c.fftBackend = type; }); }
+
+        // Times the engines for the sizes of the given orders on the rebuild thread. Until it is done automatic runs on
+        // the JUCE engine, then the current size is rebuilt on the fastest one
+        void selectFFTBackends(int firstOrder, int lastOrder);
+
+        // Frees configurations the processing thread has moved on from. Called on the settings thread,
+        // setters do it themselves, but a background rebuild can only leave the old ones behind
+        void releaseRetiredConfigs();
 
         // Subtraction Constant
-        const double& getSubtractionConstant() { return subtractionAlpha; }
-        void setSubtractionConstant(const double& constant) { subtractionAlpha = constant; }
+        double getSubtractionConstant() const { return latestConfig().subtractionAlpha; }
+        void setSubtractionConstant(const double& constant) { updateConfig([=](Config& c) { c.subtractionAlpha = constant; }); }
 
         // Subtraction Floor
-        const double& getSubtractionFloor() { return subtractionFloor; }
-        void setSubtractionFloor(const double& floor) { subtractionFloor = floor; }
+        double getSubtractionFloor() const { return latestConfig().subtractionFloor; }
+        void setSubtractionFloor(const double& floor) { updateConfig([=](Config& c) { c.subtractionFloor = floor; }); }
 
         // Subtraction Domain
-        int getSubtractionDomain() const { return subtractionDomain; }
-        void setSubtractionDomain(const int& domain) { subtractionDomain = domain; }
+        int getSubtractionDomain() const { return latestConfig().subtractionDomain; }
+        void setSubtractionDomain(const int& domain) { updateConfig([=](Config& c) { c.subtractionDomain = domain; }); }
 
         // Noise Estimation Enabled
-        bool getNoiseEstimationEnabled() const { return noiseEstimationEnabled; }
-        void setNoiseEstimationEnabled(bool enabled) { noiseEstimationEnabled = enabled; }
+        bool getNoiseEstimationEnabled() const { return latestConfig().noiseEstimationEnabled; }
+        void setNoiseEstimationEnabled(bool enabled) { updateConfig([=](Config& c) { c.noiseEstimationEnabled = enabled; }); }
 
         // Subtraction Enabled
-        bool getSubtractionEnabled() const { return subtractionEnabled; }
-        void setSubtractionEnabled(bool enabled) { subtractionEnabled = enabled; }
+        bool getSubtractionEnabled() const { return latestConfig().subtractionEnabled; }
+        void setSubtractionEnabled(bool enabled) { updateConfig([=](Config& c) { c.subtractionEnabled = enabled; }); }
+
+        // Synthesis Normalisation Enabled, divides out the summed analysis windows at every position when frames are
+        // overlap-added. Otherwise frames are scaled by the window's constant overlap-add gain for the hop, which is
+        // exact for windows that overlap-add to a constant at that hop
+        bool getSynthesisNormalisationEnabled() const { return latestConfig().synthesisNormalisationEnabled; }
+        void setSynthesisNormalisationEnabled(bool enabled) { updateConfig([=](Config& c) { c.synthesisNormalisationEnabled = enabled; }); }
+
+        // Low Latency Enabled, analyses the full window with an asymmetric window but only synthesises its last two
+        // hops, so the stream's delay is two hops rather than a window while the frequency resolution is unchanged
+        bool getLowLatencyEnabled() const { return latestConfig().lowLatencyEnabled; }
+        void setLowLatencyEnabled(bool enabled) { updateConfig([=](Config& c) { c.lowLatencyEnabled = enabled; }); }
+        int getLowLatencyHopSize() const { return latestConfig().lowLatencyHopSize; }
+        void setLowLatencyHopSize(int numSamples) { updateConfig([=](Config& c) { c.lowLatencyHopSize = numSamples; }); }
+
+        // Processing Rate, the band below its Nyquist frequency is decimated before processing and interpolated back after.
+        // The device rate is divided by the largest whole factor that keeps at least the given rate, 0 processes at the device rate
+        float getProcessingRate() const { return latestConfig().sampleRate / (float)latestConfig().decimationFactor; }
+        int getDecimationFactor() const { return latestConfig().decimationFactor; }
+        void setProcessingRate(float rate) { updateConfig([=](Config& c) { c.processingRate = rate; }); }
+
+        // Upper Band Gain, the linear gain of everything above the processing band at a reduced rate. 1 passes it through
+        // unprocessed and 0 removes it
+        float getUpperBandGain() const { return latestConfig().upperBandGain; }
+        void setUpperBandGain(float gain) { updateConfig([=](Config& c) { c.upperBandGain = gain; }); }
 
         // Adaptive Estimation Enabled
-        bool getAdaptivateEstimationEnabled() const { return adaptiveEstimationEnabled; }
-        void setAdaptiveEstimationEnabled(bool enabled) { adaptiveEstimationEnabled = enabled; }
+        bool getAdaptivateEstimationEnabled() const { return latestConfig().adaptiveEstimationEnabled; }
+        void setAdaptiveEstimationEnabled(bool enabled) { updateConfig([=](Config& c) { c.adaptiveEstimationEnabled = enabled; }); }
+
+        // Noise Estimator, minimum tracking runs whenever adaptive estimation is on. Changing it starts the estimate over.
+        // Its smoothing takes the place of the estimation smoothing, and it leaves the SNR at zero
+        NoiseEstimator getNoiseEstimator() const { return latestConfig().noiseEstimator; }
+        void setNoiseEstimator(NoiseEstimator estimator) { updateConfig([=](Config& c) { c.noiseEstimator = estimator; ++c.estimationResets; }); }
 
         // Smoothing Rate
-        float getSmoothingRate() const { return smoothingRate; }
-        void setSmoothingRate(float a) { smoothingRate = a; }
+        float getSmoothingRate() const { return latestConfig().smoothingRate; }
+        void setSmoothingRate(float a) { updateConfig([=](Config& c) { c.smoothingRate = a; }); }
 
         // Smoothing Curve
-        float getSmoothingCurve() const { return smoothingCurve; }
-        void setSmoothingCurve(float T) { smoothingCurve = T; }
+        float getSmoothingCurve() const { return latestConfig().smoothingCurve; }
+        void setSmoothingCurve(float T) { updateConfig([=](Config& c) { c.smoothingCurve = T; }); }
         
         // Frequency Bands
-        int getNumFrequencyBands() { return numFrequencyBands; }
-        void setNumFrequencyBands(int num) { numFrequencyBands = num; calculateFrequencyBands(); }
+        int getNumFrequencyBands() const { return latestConfig().numFrequencyBands; }
+        void setNumFrequencyBands(int num) { updateConfig([=](Config& c) { c.numFrequencyBands = num; }); }
 
         // Band Weight
-        void setBandWeight(int index, double weight) { bandWeights[index] = weight; }
+        void setBandWeight(int index, double weight) { updateConfig([=](Config& c) { c.bandWeights[(size_t)index] = weight; }); }
+
+        // Perceptual Bands, the noise estimate and the gains are computed on ERB spaced bands and the gains interpolated
+        // back to the bins. Each band sets its own over subtraction, weighted by the frequency band its centre is in.
+        // The noise estimate, SNR and smoothing are then per band, bandsToBins spreads them over the bins to show them
+        bool getPerceptualBandsEnabled() const { return latestConfig().perceptualBandsEnabled; }
+        void setPerceptualBandsEnabled(bool enabled) { updateConfig([=](Config& c) { c.perceptualBandsEnabled = enabled; }); }
+        int getNumPerceptualBands() const { return latestConfig().numPerceptualBands; }
+        void setNumPerceptualBands(int num) { updateConfig([=](Config& c) { c.numPerceptualBands = juce::jlimit(1, PerceptualBands::maxBands, num); }); }
+        Frame bandsToBins(const Frame& values) const;
 
     private:
-        bool noiseEstimationEnabled = false;
-        bool subtractionEnabled = false;
-        bool adaptiveEstimationEnabled = false;
+        // Times the private processing stages, see Benchmarks/StageBenchmark.cpp
+        friend class StageBenchmark;
+
+        struct Config;
+        struct ProcessingState;
+        struct EstimationState;
+
+        // Computes the gains for a frame, specialised for the current domain and band count
+        typedef void (SpectralSubtraction::*SubtractionKernel)(const Config&, const Spectrum&, const Frame&, FrameWorkspace&);
+
+        // Workspaces and stream buffers, sized for one fft size, hop and block size. Shared by every
+        // configuration with those sizes and only written by the thread that processes
+        struct ProcessingState
+        {
+            ProcessingState(const Config& config);
+            void prepareBlocks(const Config& config, int maxBlockSize);
+            bool matches(const Config& config) const;
+
+            const int fftSize;
+            const FFTBackend::Type fftType;
+            const int hopSize;
+            const int synthesisSize;
+            const int decimationFactor;
+            const int preparedBlock;
+
+            FrameWorkspace workspace;
+            int maxBlock = 0;
+            SpectrumMatrix blockSpectra;
+            Matrix blockCleanFrames;
+            std::vector<float> blockSamples;
+
+            // The last window of input, a frame is read from it in place every hop
+            CircularBuffer<float> streamInput;
+
+            // Finished output, followed in the free space by the partial sums of the frames still being added
+            CircularBuffer<float> streamOutput;
+            int streamResets = 0;
+
+            // At a reduced rate the stream runs on the decimated input. The band it replaces is the decimated input delayed
+            // by the stream, and the input delayed by the whole path is what the upper band is taken from
+            void clearBands(const Config& config);
+            PolyphaseDecimator bandDecimator;
+            PolyphaseInterpolator bandInterpolator;
+            CircularBuffer<float> lowerBandDelay;
+            CircularBuffer<float> upperBandDelay;
+            std::vector<float> bandSamples;
+            std::vector<float> delayedBandSamples;
+        };
+
+        // The adaptive noise estimate, a ring of the most recent estimates and their per bin sum
+        struct EstimationState
+        {
+            EstimationState(const Config& config);
+            bool matches(const Config& config) const;
+
+            const int numBins;
+            const int decimationFactor;
+            std::vector<Frame> noiseEstimation;
+            std::vector<double> noiseEstimationSum;
+            int noiseEstimationStart = 0;
+            int noiseEstimationCount = 0;
+            Frame a_SNR;
+            Frame estimationSmoothing;
+            int estimationResets = 0;
+
+            // Minimum tracking. The smoothed values, the minimum of the sub-window under way, of each of the last
+            // minimumSubWindows and of all of them together, the chance of speech and the noise estimate itself
+            static constexpr int minimumSubWindows = 8;
+            Frame smoothedValues;
+            Frame subWindowMinimum;
+            std::vector<Frame> subWindowMinima;
+            Frame trackedMinimum;
+            Frame speechPresence;
+            Frame trackedNoise;
+            int subWindowPosition = 0;
+            int subWindowIndex = 0;
+            bool trackingStarted = false;
+        };
+
+        // Every setting and the tables derived from them. Never changed once published, setters
+        // publish a modified copy
+        struct Config
+        {
+            const Frame& getWindow() const { return lowLatencyEnabled ? *lowLatencyWindow : (*windows)[windowType]; }
+
+            // Frames are weighted per position on overlap-add rather than by a constant gain
+            bool usesOverlapScale() const { return synthesisNormalisationEnabled || lowLatencyEnabled; }
+
+            // Frames update the adaptive estimate, minimum tracking doesn't wait for noise estimation to be turned on
+            bool isEstimating() const { return adaptiveEstimationEnabled && (noiseEstimationEnabled || noiseEstimator == minimumTracking); }
+
+            bool noiseEstimationEnabled = false;
+            bool subtractionEnabled = false;
+            bool adaptiveEstimationEnabled = false;
+            bool synthesisNormalisationEnabled = false;
+
+            // Subtraction Parameters
+            double subtractionAlpha = 4;
+            double subtractionFloor = 0.03;
+            int subtractionDomain = 1;
+            SubtractionKernel subtractionKernel = nullptr;
+
+            // FFT
+            int NFFT = 0;
+            FFTBackend::Type fftBackend = FFTBackend::automatic;
+            FFTBackend::Type fftType = FFTBackend::automatic;
+            int numBins = 0;
+            int maxBlock = 0;
+
+            // Sample rates, the processing rate is the device rate over the decimation factor. NFFT is at the device
+            // rate, the window, hop and bins are at the processing rate
+            float sampleRate = 48000;
+            float processingRate = 0;
+            int decimationFactor = 1;
+            float upperBandGain = 1;
+
+            // Delay of the decimation and interpolation filters together, and of the whole stream at the device rate
+            int resamplingDelay = 0;
+            int latencySamples = 0;
+
+            // Noise Estimation
+            int noiseProfileFrames = 10;
+            Frame averageNoise;
+            int averageNoiseFactor = 1; // Decimation the profile was taken at
+            float smoothingCurve = 3; // T
+            float smoothingRate = 3;
+
+            // Minimum tracking's smoothing factors per hop, the hops in a sub-window and the speech threshold in the subtraction domain
+            NoiseEstimator noiseEstimator = smoothedEstimator;
+            float minimumSmoothing = 0;
+            float presenceSmoothing = 0;
+            float trackingSmoothing = 0;
+            int subWindowFrames = 1;
+            float presenceThreshold = 5;
+
+            // Window, every window type is built once per size and shared
+            std::shared_ptr<const std::vector<Frame>> windows;
+            Window::WindowingMethod windowType = Window::hamming;
+            int windowSize = 0;
+            float windowOverlap = 0.5f;
+            int hopSize = 0;
+            Frame overlapScale;
+            float overlapGain = 1;
+
+            // Low latency analysis window, the matching synthesis window is kept in overlapScale. Only the last
+            // synthesisSize samples of each frame reach the output
+            bool lowLatencyEnabled = false;
+            int lowLatencyHopSize = 128;
+            std::shared_ptr<const Frame> lowLatencyWindow;
+            int synthesisSize = 0;
+
+            // Frequency Bands
+            int numFrequencyBands = 1;
+            std::vector<double> bandWeights = std::vector<double>(8, 1.0);
+            std::vector<std::pair<int, int>> frequencyBandRanges;
+
+            // Perceptual Bands, the table is only built while they are enabled. The estimate is kept per band, and the
+            // noise profile is kept per bin with a per band copy
+            bool perceptualBandsEnabled = false;
+            int numPerceptualBands = 32;
+            std::shared_ptr<const PerceptualBands> perceptualBands;
+            Frame perceptualBandWeights;
+            Frame averageBandNoise;
+
+            // Values in a noise estimate, one per band or per bin
+            int getNumEstimates() const { return perceptualBands != nullptr ? perceptualBands->getNumBands() : numBins; }
+
+            // Resets asked for by the settings thread, carried out by the processing thread
+            int streamResets = 0;
+            int estimationResets = 0;
+
+            std::shared_ptr<ProcessingState> processing;
+            std::shared_ptr<EstimationState> estimation;
+        };
 
-        float sampleRate = 48000;
         juce::AudioSampleBuffer* signal = nullptr;
 
-        // Subtraction Parameters
-        double subtractionAlpha = 4;
-        double subtractionFloor = 0.03;
-        int subtractionDomain = 1;
-
-        // FFT
-        juce::dsp::FFT* fft = nullptr;
-        int order;
-        int NFFT;
-        int noiseProfileFrames = 10;
-
-        // Noise Estimation
-        std::deque<Frame> noiseEstimation;
-        Frame averageNoise;
-        Frame noiseSubtracted;
-        Frame a_SNR;
-        Frame estimationSmoothing;
+        // Fixed estimation constants
         float SNR_min = -5;
         float SNR_max = 20;
         float snrQuality = 0.98f;
         float alpha_min = 1;
-        float smoothingCurve = 3; // T
-        float smoothingRate = 3;
-        int frameNumber = 0;
-
-        // Window
-        std::vector<Frame> windows;
-        Window::WindowingMethod windowType = Window::hamming;
-        int windowSize;
-        float windowOverlap = 0.5f;
-        int hopSize;
-
-        // Frequency Bands
-        int numFrequencyBands = 1;
-        std::vector<double> bandWeights;
-        std::vector<std::pair<int, int>> frequencyBandRanges;
-
-
 
+        // Minimum tracking time constants in seconds, the span the minimum is taken over, and how far above it the
+        // smoothed power has to rise to count as speech
+        float minimumSmoothingTime = 0.07f;
+        float presenceSmoothingTime = 0.01f;
+        float trackingSmoothingTime = 0.3f;
+        float minimumWindowTime = 1.5f;
+        float speechPowerRatio = 5;
+
+        // Frames per range claimed by a render thread. Fixed so the output never depends on the thread count
+        int renderChunkFrames = 64;
+
+        // Published configurations, the newest is last. The settings thread owns them, the rebuild thread
+        // only adds to them under the lock. The processing thread marks the one it is reading as in use,
+        // and the one it is handing over from, and both are kept until the processing thread moves on
+        std::vector<std::unique_ptr<Config>> configs;
+        std::atomic<const Config*> publishedConfig { nullptr };
+        std::atomic<const Config*> configInUse { nullptr };
+        std::atomic<const Config*> fadingConfigInUse { nullptr };
+        const Config* activeConfig = nullptr;
+        juce::CriticalSection configLock;
+
+        // After a size change the outgoing stream keeps playing until the incoming one has a full
+        // window behind its output, then fades out over one hop. Only used by the processing thread
+        const Config* fadingConfig = nullptr;
+        int transitionPosition = 0;
+        int transitionPrimeSamples = 0;
+        int transitionFadeSamples = 0;
+
+        // Samples pulled from the stream before they were ready, filled with silence
+        std::atomic<juce::int64> underrunSamples { 0 };
+
+        // Builds configurations for a new fft size or engine. Declared last so it stops before the configurations go
+        std::atomic<int> requestedSize { 0 };
+        juce::ThreadPool rebuildPool { 1 };
+
+
+
+
+        // Configuration
+        const Config& latestConfig() const;
+        const Config& acquireConfig(bool streaming = false);
+        void publishConfig(std::unique_ptr<Config> next, bool releaseRetired = true);
+        void prepareConfig(Config& next, const Config* previous);
+        void rebuildConfig();
+
+        template <typename Change>
+        void updateConfig(Change change)
+        {
+            const juce::ScopedLock lock(configLock);
+            std::unique_ptr<Config> next(new Config(latestConfig()));
+            change(*next);
+            publishConfig(std::move(next));
+        }
+
+        // Handing over between configurations on the processing thread
+        void beginTransition(const Config& previous, const Config& next);
+        void projectEstimation(const Config& from, const Config& to);
+        static void projectSpectrum(const Frame& source, int sourceBins, Frame& destination, int destinationBins, float scale, float rateRatio = 1);
+        void endTransition();
+        void crossfadeStreams(float* samples, int numSamples);
 
         // Helper functions
-        SpectrumMatrix createFrequencyData(const Matrix& frames);
-        std::vector<float> createSamplesFromFrames(const Matrix& frames, int windowLength, int hopLength);
-        Matrix createSignalFrames(const float* buffer, int size, int windowLength, int hopLength);
-        Frame noiseAverageSpectrum(const Matrix& frames);
-        Spectrum frequencySpectrum(const Frame& frame);
-        void createWindow();
-        Spectrum calculateFFT(Frame& fft_input);
-        Frame calculateIFFT(Spectrum& ifft_input);
-        double segmentalSNR(const Spectrum& currFrame, const Frame& estimateFrame, const std::pair<int, int>& range);
-        double aposterioriSNR(const Frame& powerSpectrum, int omega);
-        double aprioriSNR(const Frame& speechSpectrum, double apostSNR, int omega);
-        double calculateOverSubtraction(double snr);
-        double calculateSmoothingParameter(double snr);
-        double sumSpectrum(const Spectrum& frame, const std::pair<int, int>& range);
+        int createFrequencyData(const Config& config, const FrameView& frames, SpectrumMatrix& frequencyData);
+        int subtractFrames(const Config& config, const SpectrumMatrix& frequencyData, int numFrames, Matrix& output);
+        int createSamplesFromFrames(const Config& config, const Matrix& frames, int numFrames, int windowLength, int hopLength, std::vector<float>& samples);
+        Frame noiseAverageSpectrum(const Config& config, const FrameView& frames);
+        void frequencySpectrum(const Config& config, const FrameRegions& frame, Spectrum& spectrum, FrameWorkspace& workspace);
+        void processFrame(const Config& config, const FrameRegions& frame, FrameWorkspace& workspace);
+        void windowFrame(const Config& config, const FrameRegions& frame, float* destination);
+        void renderSamples(const Config& config, const float* input, float* output, int numSamples, juce::ThreadPool* pool);
+        std::vector<float> decimateBuffer(const Config& config, const float* samples, int numSamples);
+        void renderFrames(const Config& config, const FrameView& frames, int firstFrame, int lastFrame, float* output, FrameWorkspace& workspace);
+        void subtractFrame(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, Frame& output, FrameWorkspace& workspace);
+        void selectSubtractionKernel(Config& config);
+        template <bool powerDomain, bool multiBand>
+        void calculateGains(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, FrameWorkspace& workspace);
+        template <bool powerDomain>
+        void calculateBandGains(const Config& config, const Spectrum& dirtyFrame, const Frame& noiseEst, FrameWorkspace& workspace);
+        void streamSamples(const Config& config, const float* samples, int numSamples);
+        void writeStream(const Config& config, const float* samples, int numSamples);
+        int pullStream(const Config& config, float* samples, int numSamples);
+        int readStream(const Config& config, float* samples, int numSamples);
+        void processStreamFrame(const Config& config);
+        void clearStream(const Config& config);
+        void updateAdaptiveEstimate(const Config& config, const Spectrum& spectrum, FrameWorkspace& workspace);
+        const Frame* getNoiseEstimation(const Config& config) const;
+        void updateNoiseEstimation(const Config& config, const Frame& powerSpectrum);
+        void trackNoiseMinimum(const Config& config, const Frame& values);
+        void applyEstimationResets(const Config& config);
+        void createWindow(Config& config);
+        void calculateOverlapScale(Config& config);
+        void createLowLatencyWindows(Config& config);
+        void overlapAddFrame(const Config& config, const Frame& frame, float* destination);
+        void accumulateFrame(const Config& config, const Frame& frame, int frameOffset, const CircularBuffer<float>::Regions<float*>& window, int from, int to, bool overwrite);
+        void calculateFFT(Spectrum& spectrum, FrameWorkspace& workspace);
+        void calculateIFFT(Spectrum& spectrum, Frame& result, FrameWorkspace& workspace);
+        double segmentalSNR(const Frame& noisySpectrum, const Frame& estimateFrame, const std::pair<int, int>& range);
+        double aposterioriSNR(const Config& config, const Frame& powerSpectrum, int omega);
+        double aprioriSNR(const Config& config, const Frame& speechSpectrum, double apostSNR, int omega);
+        double calculateOverSubtraction(const Config& config, double snr);
+        double calculateSmoothingParameter(const Config& config, double snr);
+        void resumNoiseEstimation(EstimationState& estimation, int numEstimates);
+        void clearEstimation(EstimationState& estimation);
         double sumFrame(const Frame& frame, const std::pair<int, int>& range);
-        void calculateFrequencyBands();
-        Frame complexToPowerSpectrum(const Spectrum& spectrum);
-        Frame complexToMagnitudeSpectrum(const Spectrum& spectrum);       
-};
\ No newline at end of file
+        void calculateFrequencyBands(Config& config);
+        void calculatePerceptualBands(Config& config);
+        void calculateMinimumTracking(Config& config);
+        void complexToPowerSpectrum(const Spectrum& spectrum, Frame& powerSpectrum);
+        void complexToMagnitudeSpectrum(const Spectrum& spectrum, Frame& magnitudeSpectrum);
+};
@@ -54,10 +54,10 @@ void SpectrumGraph::resized()
 
 }
 
-void SpectrumGraph::addFrequencyData(const std::vector<double>& frequencyData)
+void SpectrumGraph::addFrequencyData(const std::vector<float>& frequencyData)
 {
     juce::MessageManagerLock lock;
-    fftData = frequencyData;
+    fftData.assign(frequencyData.begin(), frequencyData.end());
     setScopedData();
     repaint();
 }
@@ -120,12 +120,14 @@ void SpectrumGraph::drawFrame(juce::Graphics& g)
 void SpectrumGraph::setScopedData()
 {
     double maxdB = 0.0;
-    int fftSize = fftData.size();
+    // Data holds the non-negative frequencies only, the last bin is Nyquist
+    int numBins = fftData.size();
+    int fftSize = 2 * (numBins - 1);
 
     for (int i = 0; i < scopeSize; ++i)
     {
         float skewedProportionX = 1.0f - std::exp(std::log(1.0f - (float)i / (float)scopeSize) * 0.2f);
-        int fftDataIndex = juce::jlimit(0, fftSize / 2, (int)(skewedProportionX * (float)fftSize * 0.5f));
+        int fftDataIndex = juce::jlimit(0, numBins - 1, (int)(skewedProportionX * (float)(numBins - 1)));
         double level = juce::jmap(juce::jlimit((double)minimumDB, maxdB, juce::Decibels::gainToDecibels(fftData[fftDataIndex])
             - juce::Decibels::gainToDecibels((float)fftSize)),
             (double)minimumDB, maxdB, 0.0, 1.0);
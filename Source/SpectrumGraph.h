@@ -24,15 +24,15 @@ public:
     void paint (juce::Graphics&) override;
     void resized() override;
 
-    void addFrequencyData(const std::vector<double>& frequencyData);
+    void addFrequencyData(const std::vector<float>& frequencyData);
 
     void clear();
 
     void setTitleText(std::string titleText);
     void setSamplingRate(float rate) { samplingRate = rate; }
 
-    void setSNR(const std::vector<double>& snr) { snrData = snr; }
-    void setSmoothingData(const std::vector<double>& smoothing) { smoothingData = smoothing; }
+    void setSNR(const std::vector<float>& snr) { snrData.assign(snr.begin(), snr.end()); }
+    void setSmoothingData(const std::vector<float>& smoothing) { smoothingData.assign(smoothing.begin(), smoothing.end()); }
     void setNumFrequencyBands(int numBands) { numFrequencyBands = numBands; }
 private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectrumGraph)
@@ -13,13 +13,13 @@
 #include "MainComponent.h"
 #include <complex>
 #include "FileManager.h"
+#include "AllocationTrap.h"
 
 #include "FrequencyGraph.cpp"
 
 
 //==============================================================================
-SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph(11), noiseEstimateGraph(11), realtimeBuffer(), realtimeOut(),
-                                   outputSignal(1)
+SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph(11), noiseEstimateGraph(11), outputSignal(1)
 {
     startTimer(100);
 
@@ -83,6 +83,14 @@ SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph
     adaptiveEstimationButton.setToggleState(false, juce::dontSendNotification);
     adaptiveEstimationButton.setColour(juce::TextButton::ColourIds::buttonOnColourId, juce::Colours::green);
 
+    // Low Latency Button
+    addAndMakeVisible(lowLatencyButton);
+    lowLatencyButton.onClick = [this] { onButtonClick(&lowLatencyButton); };
+    lowLatencyButton.setButtonText("Low Latency");
+    lowLatencyButton.setClickingTogglesState(true);
+    lowLatencyButton.setToggleState(false, juce::dontSendNotification);
+    lowLatencyButton.setColour(juce::TextButton::ColourIds::buttonOnColourId, juce::Colours::green);
+
 
     // Window Dropdown
     addAndMakeVisible(windowDropdown);
@@ -112,6 +120,9 @@ SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph
     fftOrderSlider.setValue(11, juce::NotificationType::dontSendNotification);
     fftOrderSlider.setSliderStyle(juce::Slider::SliderStyle::LinearBar);
 
+    // Time the fft engines for every size the slider offers in the background, rather than when the slider first reaches it
+    spectralSubtraction.selectFFTBackends((int)fftOrderSlider.getMinimum(), (int)fftOrderSlider.getMaximum());
+
     addAndMakeVisible(fftOrderLabel);
     fftOrderLabel.setText("Window Size", juce::NotificationType::dontSendNotification);
     fftOrderLabel.setJustificationType(juce::Justification::centredTop);
@@ -119,7 +130,7 @@ SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph
     // Noise profile frames slider
     addAndMakeVisible(&noiseProfileFramesSlider);
     noiseProfileFramesSlider.addListener(this);
-    noiseProfileFramesSlider.setRange(5, 15, 1.0);
+    noiseProfileFramesSlider.setRange(5, 60, 1.0);
     noiseProfileFramesSlider.setValue(10, juce::NotificationType::dontSendNotification);
     noiseProfileFramesSlider.setEnabled(true);
     noiseProfileFramesSlider.setSliderStyle(juce::Slider::SliderStyle::LinearBar);
@@ -189,6 +200,36 @@ SpeechEnhancer::SpeechEnhancer() : spectralSubtraction(11), outputFrequencyGraph
     domainLabel.setText("Domain", juce::NotificationType::dontSendNotification);
     domainLabel.setJustificationType(juce::Justification::centredTop);
 
+    // Processing rate, the band above it is passed through, attenuated or muted
+    addAndMakeVisible(&processingRateDropdown);
+    processingRateDropdown.addItem("Device Rate", 1);
+    processingRateDropdown.addItem("24 kHz", 2);
+    processingRateDropdown.addItem("16 kHz", 3);
+    processingRateDropdown.onChange = [this]{ onDropdownChange(&processingRateDropdown); };
+    processingRateDropdown.setSelectedItemIndex(0, juce::NotificationType::dontSendNotification);
+    addAndMakeVisible(&upperBandDropdown);
+    upperBandDropdown.addItem("Upper Band On", 1);
+    upperBandDropdown.addItem("Upper Band -12 dB", 2);
+    upperBandDropdown.addItem("Upper Band Off", 3);
+    upperBandDropdown.onChange = [this]{ onDropdownChange(&upperBandDropdown); };
+    upperBandDropdown.setSelectedItemIndex(0, juce::NotificationType::dontSendNotification);
+
+    // Gains on linear frequency bands or on ERB spaced perceptual bands
+    addAndMakeVisible(&perceptualBandsDropdown);
+    perceptualBandsDropdown.addItem("Linear", 1);
+    perceptualBandsDropdown.addItem("24 ERB", 2);
+    perceptualBandsDropdown.addItem("32 ERB", 3);
+    perceptualBandsDropdown.addItem("40 ERB", 4);
+    perceptualBandsDropdown.onChange = [this]{ onDropdownChange(&perceptualBandsDropdown); };
+    perceptualBandsDropdown.setSelectedItemIndex(0, juce::NotificationType::dontSendNotification);
+
+    // How the adaptive estimate follows the noise, minimum tracking doesn't need the noise profile toggled on
+    addAndMakeVisible(&noiseEstimatorDropdown);
+    noiseEstimatorDropdown.addItem("Smoothed Estimator", 1);
+    noiseEstimatorDropdown.addItem("Minimum Tracking", 2);
+    noiseEstimatorDropdown.onChange = [this]{ onDropdownChange(&noiseEstimatorDropdown); };
+    noiseEstimatorDropdown.setSelectedItemIndex(0, juce::NotificationType::dontSendNotification);
+
 }
 
 SpeechEnhancer::~SpeechEnhancer()
@@ -213,6 +254,7 @@ void SpeechEnhancer::resized()
     enabledButton.setBounds(width * 0.01f, height * 0.01f, width * 0.15, height / 16.f);
     computeButton.setBounds(width * (0.5f / 3.f), height * 0.01f, width * 0.15, height / 16.f);
     adaptiveEstimationButton.setBounds(width * (1.f / 3.f), height * 0.01f, width * 0.15, height / 16.f);
+    noiseEstimatorDropdown.setBounds(width * (1.f / 3.f), height * 0.073f, width * 0.15, height / 40.f);
 
     domainLabel.setBounds(width * 0.01f, height * 0.1f, width * 0.225f, height / 32.f);
     domainDropdown.setBounds(width * 0.01f, height * 0.13f, width * 0.225f, height / 32.f);
@@ -241,6 +283,11 @@ void SpeechEnhancer::resized()
     frequencyBandsLabel.setBounds(width * 0.01f, height * 0.48f, width * 0.225f, height / 32.f);
     frequencyBandsSlider.setBounds(width * 0.01f, height * 0.5f, width * 0.225f, height / 32.f);
 
+    lowLatencyButton.setBounds(width * 0.01f, height * 0.57f, width * 0.15, height / 16.f);
+    perceptualBandsDropdown.setBounds(width * 0.165f, height * 0.585f, width * 0.07f, height / 32.f);
+    processingRateDropdown.setBounds(width * 0.01f, height * 0.635f, width * 0.11f, height / 32.f);
+    upperBandDropdown.setBounds(width * 0.125f, height * 0.635f, width * 0.11f, height / 32.f);
+
 
     noiseSpectrumGraph.setBounds  (width / 2.f, 0,                width / 2.f, height / 3.f);
     outputSignal.setBounds        (width / 2.f, height / 3.f,     width / 2.f, height / 3.f);
@@ -261,17 +308,22 @@ void SpeechEnhancer::initialize(float samplingRate, int samplesExpected, MainCom
     mainComponent = parent;
     sampleRate = samplingRate;
     spectralSubtraction.setSampleRate(samplingRate);
-    noiseEstimateGraph.setSamplingRate(sampleRate);
-    noiseSpectrumGraph.setSamplingRate(sampleRate);
+    noiseEstimateGraph.setSamplingRate(spectralSubtraction.getProcessingRate());
+    noiseSpectrumGraph.setSamplingRate(spectralSubtraction.getProcessingRate());
     outputFrequencyGraph.setSamplingRate(sampleRate);
 
-    float latency = ((spectralSubtraction.getWindowSize() * 1.5f) / sampleRate) * 1000.f;
-    mainComponent->inputManager.setLatency(latency);
+    // Scratch block for moving samples into the stream
+    int maxBlockSize = std::max(samplesExpected, 1);
+    realtimeInput.resize(maxBlockSize);
+    spectralSubtraction.prepareFFTSize(maxBlockSize, spectralSubtraction.getFFTSize());
+    updateLatency();
 }
 
 
 void SpeechEnhancer::processBuffer(const juce::AudioSourceChannelInfo& bufferToFill)
 {
+    // Nothing below may allocate, everything is sized in initialize or on the message thread
+    const ScopedAllocationTrap allocationTrap;
 
     if (mainComponent->inputManager.getInputType() == InputType::FileInput && mainComponent->inputManager.fileManager.state != TransportState::Playing)
         return;
@@ -280,13 +332,13 @@ void SpeechEnhancer::processBuffer(const juce::AudioSourceChannelInfo& bufferToF
     {
         for (int i = 0; i < bufferToFill.numSamples; ++i)
         {
+            // Capacity was reserved when recording started
             microphoneNoiseProfileBuffer.push_back(bufferToFill.buffer->getSample(0, i));
-            if (microphoneNoiseProfileBuffer.size() == spectralSubtraction.getNoiseProfileSize())
+            if (microphoneNoiseProfileBuffer.size() == noiseProfileRecordingSize)
             {
-                const juce::MessageManagerLock mmLock;
-                spectralSubtraction.setAverageNoise(spectralSubtraction.bufferToNoiseProfile(microphoneNoiseProfileBuffer));
+                // The profile itself is computed on the message thread
                 isRecordingInput = false;
-                setNoiseEstimationGraph();
+                isNoiseProfileRecorded = true;
                 break;
             }
         }
@@ -308,107 +360,76 @@ void SpeechEnhancer::processBuffer(const juce::AudioSourceChannelInfo& bufferToF
 
 void SpeechEnhancer::processRealtime(const juce::AudioSourceChannelInfo& bufferToFill)
 {
-    int numOutputChannels = bufferToFill.buffer->getNumChannels();
     int numSamples = bufferToFill.numSamples;
-    int windowSize = spectralSubtraction.getWindowSize();
-    int hopSize = windowSize / 2;
+    int blockSize = realtimeInput.size();
+    if (blockSize == 0)
+        return;
 
     InputType inputType = mainComponent->inputManager.getInputType();
     juce::AudioSampleBuffer* noiseBuffer = inputType == InputType::MicrophoneInput ? bufferToFill.buffer : mainComponent->inputManager.fileManager.getBuffer();
 
-
-    // Add to circular buffer
-    for (int i = 0; i < numSamples; ++i)
+    // Work through the callback in chunks of the scratch block size
+    for (int offset = 0; offset < numSamples; offset += blockSize)
     {
-        if (inputType == InputType::FileInput)
+        int samplesThisTime = std::min(blockSize, numSamples - offset);
+
+        // Gather input samples
+        for (int i = 0; i < samplesThisTime; ++i)
         {
-            if (bufferPosition >= noiseBuffer->getNumSamples())
+            if (inputType == InputType::FileInput)
             {
-                bufferPosition = 0;
-                //frameNumber = 0;
+                if (bufferPosition >= noiseBuffer->getNumSamples())
+                {
+                    bufferPosition = 0;
+                }
             }
-        }
-
-        float sample = inputType == InputType::MicrophoneInput ? noiseBuffer->getSample(0, i) : noiseBuffer->getSample(0, bufferPosition);
 
-        //Start a new frame every hopSize samples
-        if (position % hopSize == 0)
-        {
-            realtimeBuffer.push_back(CircularBuffer<float>(windowSize * 2));
+            int index = offset + i;
+            realtimeInput[i] = inputType == InputType::MicrophoneInput ? noiseBuffer->getSample(0, index) : noiseBuffer->getSample(0, bufferPosition);
+            bufferPosition++;
         }
 
-        // Copy sample into every frame that isn't full
-        for (int j = 0; j < realtimeBuffer.size(); ++j)
-        {
-            if (realtimeBuffer[j].size() < windowSize)
-                realtimeBuffer[j].enqueue(sample);
-        }
-        position++;
-        bufferPosition++;
+        // Each hop is processed exactly once by the stream, and the output is copied into every channel
+        spectralSubtraction.pushSamples(&realtimeInput[0], samplesThisTime);
+        spectralSubtraction.pullSamples(*bufferToFill.buffer, offset, samplesThisTime);
     }
+}
 
-    // Process on buffers
-    if (realtimeBuffer.size() > 1 && (realtimeBuffer[0].size() == windowSize && realtimeBuffer[1].size() == windowSize))
+// Periodically draw the noise estimation graph
+void SpeechEnhancer::timerCallback()
+{
+    if (isNoiseProfileRecorded)
     {
-        std::vector<float> outBuffer(hopSize + windowSize, 0.f);
-
-        // Loop over all frames, only processing full frames
-        for (int frame = 0; frame < realtimeBuffer.size(); ++frame)
-        {
-            CircularBuffer<float>& currFrame = realtimeBuffer[frame];
-            if (currFrame.size() < windowSize)
-                continue;
-
-            float* fullBuffer = currFrame.getBuffer();
-
-            // Get the active section of the circular buffer
-            std::vector<float> tempBuffer = currFrame.toVector();
-
-            // Process subtraction
-            spectralSubtraction.processBuffer(&tempBuffer[0], windowSize);
-
-            // Add to output buffer
-            for (int k = 0; k < windowSize; ++k)
-            {
-                outBuffer[(frame * hopSize) + k] += tempBuffer[k];
-            }
-        }
-        // Remove first frame
-        realtimeBuffer.pop_front();
-
-        // First frame does not have any overlap over first hopSize samples, but others do which we don't want to add
-        int start = (frameNumber == 0) ? 0 : hopSize;
-        for (int x = start; x < windowSize; ++x)
-        {
-            realtimeOut.push_back(outBuffer[x]);
-        }
-        frameNumber++;
+        spectralSubtraction.setAverageNoise(spectralSubtraction.bufferToNoiseProfile(microphoneNoiseProfileBuffer));
+        isNoiseProfileRecorded = false;
     }
 
+    // Pick up a rebuilt fft order and free the configurations it replaced
+    spectralSubtraction.releaseRetiredConfigs();
+    if (mainComponent != nullptr && spectralSubtraction.getLatencySamples() != reportedLatencySamples)
+        updateLatency();
 
+    // Show which engine the current size runs on
+    juce::String fftOrderText = juce::String("Window Size (") + spectralSubtraction.getFFTBackendName() + ")";
+    if (fftOrderLabel.getText() != fftOrderText)
+        fftOrderLabel.setText(fftOrderText, juce::NotificationType::dontSendNotification);
 
-    // Copy circular buffer into output
-    if (realtimeOut.size() > 0)
+    // The stream fills with silence when it runs dry, show it next to the latency so it is not mistaken for subtraction
+    juce::int64 underrunSamples = spectralSubtraction.getUnderrunSamples();
+    if (mainComponent != nullptr && underrunSamples != reportedUnderrunSamples)
     {
-        for (int i = 0; i < numSamples; ++i)
-        {
-            float sample = realtimeOut.front();
-            realtimeOut.pop_front();
-            for (int channel = 0; channel < numOutputChannels; ++channel)
-            {
-                float* outBuffer = bufferToFill.buffer->getWritePointer(channel);
-                outBuffer[i] = sample;
-            }
-            if (realtimeOut.size() == 0)
-                break;
-        }
+        reportedUnderrunSamples = underrunSamples;
+        mainComponent->inputManager.setUnderruns(underrunSamples);
     }
+
+    setNoiseEstimationGraph();
 }
 
-// Periodically draw the noise estimation graph
-void SpeechEnhancer::timerCallback()
+void SpeechEnhancer::updateLatency()
 {
-    setNoiseEstimationGraph();
+    reportedLatencySamples = spectralSubtraction.getLatencySamples();
+    float latency = (reportedLatencySamples / sampleRate) * 1000.f;
+    mainComponent->inputManager.setLatency(latency);
 }
 
 
@@ -424,7 +445,7 @@ void SpeechEnhancer::onModeChange(InputType inputType)
             {
                 computeButton.setEnabled(true);
                 bufferPosition = 0;
-                frameNumber = 0;
+                spectralSubtraction.resetStream();
                 mainComponent->inputManager.fileManager.setBufferPosition(0);
             }
             else
@@ -448,6 +469,21 @@ void SpeechEnhancer::onFileLoaded()
     computeButton.setEnabled(true);
 }
 
+// Render a whole file through the current settings, spreading the frames of each channel over the render pool.
+// An adaptive estimate starts afresh for each channel and leaves the stream's estimate as it was
+AudioSampleBuffer* SpeechEnhancer::renderFile(const AudioSampleBuffer& input)
+{
+    int numChannels = input.getNumChannels();
+    int numSamples = input.getNumSamples();
+
+    outputBuffer.reset(new AudioSampleBuffer(numChannels, numSamples));
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        spectralSubtraction.renderBuffer(input.getReadPointer(channel), outputBuffer->getWritePointer(channel), numSamples, &renderPool);
+    }
+    return outputBuffer.get();
+}
+
 void SpeechEnhancer::sliderValueChanged(Slider* slider)
 {
     if (slider == &subtractionFactorSlider)
@@ -456,9 +492,8 @@ void SpeechEnhancer::sliderValueChanged(Slider* slider)
     }
     else if (slider == &fftOrderSlider)
     {
+        // The new order is built in the background, the timer shows its latency once it is in use
         spectralSubtraction.setFFTOrder(slider->getValue());
-        float latency = ((spectralSubtraction.getWindowSize() * 1.5f) / sampleRate) * 1000.f;
-        mainComponent->inputManager.setLatency(latency);
         //setNoiseEstimationGraph();
     }
     else if (slider == &noiseProfileFramesSlider)
@@ -526,7 +561,7 @@ void SpeechEnhancer::onButtonClick(juce::Button* button)
                 }
             }
             bufferPosition = 0;
-            frameNumber = 0;
+            spectralSubtraction.resetStream();
             mainComponent->inputManager.fileManager.setBufferPosition(0);
 
         }
@@ -538,7 +573,12 @@ void SpeechEnhancer::onButtonClick(juce::Button* button)
                     spectralSubtraction.resetEstimation();
             }
             else
+            {
+                noiseProfileRecordingSize = spectralSubtraction.getNoiseProfileSize();
+                microphoneNoiseProfileBuffer.clear();
+                microphoneNoiseProfileBuffer.reserve(noiseProfileRecordingSize);
                 isRecordingInput = true;
+            }
         }
 
         enabledButton.setEnabled(true);
@@ -562,6 +602,11 @@ void SpeechEnhancer::onButtonClick(juce::Button* button)
             computeButton.setClickingTogglesState(false);
         }
     }
+    else if (button == &lowLatencyButton)
+    {
+        // The stream crossfades into the new hop, the timer shows its latency once it is in use
+        spectralSubtraction.setLowLatencyEnabled(lowLatencyButton.getToggleState());
+    }
 }
 
 
@@ -576,6 +621,31 @@ void SpeechEnhancer::onDropdownChange(juce::ComboBox* dropdown)
         int domain = domainDropdown.getSelectedId();
         spectralSubtraction.setSubtractionDomain(domain);
     }
+    else if (dropdown == &processingRateDropdown)
+    {
+        // The stream crossfades into the new rate, the noise graphs show the bins it processes
+        const float rates[] = { 0.f, 24000.f, 16000.f };
+        spectralSubtraction.setProcessingRate(rates[processingRateDropdown.getSelectedItemIndex()]);
+        noiseEstimateGraph.setSamplingRate(spectralSubtraction.getProcessingRate());
+        noiseSpectrumGraph.setSamplingRate(spectralSubtraction.getProcessingRate());
+    }
+    else if (dropdown == &upperBandDropdown)
+    {
+        const float gains[] = { 1.f, juce::Decibels::decibelsToGain(-12.f), 0.f };
+        spectralSubtraction.setUpperBandGain(gains[upperBandDropdown.getSelectedItemIndex()]);
+    }
+    else if (dropdown == &perceptualBandsDropdown)
+    {
+        const int counts[] = { 0, 24, 32, 40 };
+        int num = counts[perceptualBandsDropdown.getSelectedItemIndex()];
+        spectralSubtraction.setPerceptualBandsEnabled(num > 0);
+        if (num > 0)
+            spectralSubtraction.setNumPerceptualBands(num);
+    }
+    else if (dropdown == &noiseEstimatorDropdown)
+    {
+        spectralSubtraction.setNoiseEstimator((SpectralSubtraction::NoiseEstimator)noiseEstimatorDropdown.getSelectedItemIndex());
+    }
 }
 
 void SpeechEnhancer::setNoiseEstimationGraph()
@@ -584,12 +654,13 @@ void SpeechEnhancer::setNoiseEstimationGraph()
     if (noiseEst == nullptr)
         return;
 
+    // Estimates on perceptual bands are spread over the bins to draw them
     int size = noiseEst->size();
-    noiseSpectrumGraph.addFrequencyData(*noiseEst);
+    noiseSpectrumGraph.addFrequencyData(spectralSubtraction.bandsToBins(*noiseEst));
     const Frame& snr = spectralSubtraction.getAPosSNR();
-    noiseSpectrumGraph.setSNR(snr);
+    noiseSpectrumGraph.setSNR(spectralSubtraction.bandsToBins(snr));
     const Frame& smoothing = spectralSubtraction.getEstimationSmoothing();
-    noiseSpectrumGraph.setSmoothingData(smoothing);
+    noiseSpectrumGraph.setSmoothingData(spectralSubtraction.bandsToBins(smoothing));
 
     noiseEstimateGraph.addFrequencyData(spectralSubtraction.getNoiseSubtracted());
 }
@@ -42,23 +42,26 @@ public:
     void onModeChange(InputType inputType);
     void onFileLoaded();
 
-    AudioSampleBuffer* getOutputBuffer() const { return outputBuffer; }
+    AudioSampleBuffer* getOutputBuffer() const { return outputBuffer.get(); }
+    AudioSampleBuffer* renderFile(const AudioSampleBuffer& input);
 
     
 
     SpectralSubtraction spectralSubtraction;
 private:
-    MainComponent* mainComponent;
+    MainComponent* mainComponent = nullptr;
     float sampleRate;
 
-    AudioSampleBuffer* outputBuffer = nullptr;
-    std::deque<CircularBuffer<float>> realtimeBuffer;
-    std::deque<float> realtimeOut;
+    std::unique_ptr<AudioSampleBuffer> outputBuffer;
+    juce::ThreadPool renderPool;
+    std::vector<float> realtimeInput;
     std::vector<float> microphoneNoiseProfileBuffer;
+    int noiseProfileRecordingSize = 0;
 
     juce::TextButton enabledButton;
     juce::TextButton computeButton;
     juce::TextButton adaptiveEstimationButton;
+    juce::TextButton lowLatencyButton;
 
     juce::Slider subtractionFactorSlider;
     juce::Label subtractionFactorLabel;
@@ -79,19 +82,24 @@ private:
 
     juce::ComboBox domainDropdown;
     juce::Label domainLabel;
+    juce::ComboBox processingRateDropdown;
+    juce::ComboBox upperBandDropdown;
+    juce::ComboBox perceptualBandsDropdown;
+    juce::ComboBox noiseEstimatorDropdown;
 
 
     SpectrumGraph noiseSpectrumGraph;
     FrequencyGraph<float> outputFrequencyGraph;
-    FrequencyGraph<double> noiseEstimateGraph;
+    FrequencyGraph<float> noiseEstimateGraph;
     AudioVisualiserComponent outputSignal;
 
     juce::ComboBox windowDropdown;
     juce::Label windowLabel;
-    bool isRecordingInput = false;
-    int position = 0;
+    std::atomic<bool> isRecordingInput { false };
+    std::atomic<bool> isNoiseProfileRecorded { false };
     int bufferPosition = 0;
-    int frameNumber = 0;
+    int reportedLatencySamples = 0;
+    juce::int64 reportedUnderrunSamples = 0;
 
 
     bool isEnabled = false;
@@ -100,6 +108,8 @@ private:
 
     void setNoiseEstimationGraph();
 
+    void updateLatency();
+
     void sliderValueChanged(Slider* slider) override;
 
     void onButtonClick(juce::Button* button);